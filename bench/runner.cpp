@@ -0,0 +1,244 @@
+// Runs the Lox benchmarks and reports wall time and peak RSS of each as JSON.
+//
+// Each run forks and execs lox directly: a child's peak RSS includes whatever its parent had mapped
+// when it forked, so the runner stays small and keeps no work in memory between runs.
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fmt/format.h>
+#include <fmt/ranges.h>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+struct Benchmark
+{
+    std::string name;
+    fs::path script;
+};
+
+struct Run
+{
+    double seconds;
+    long peakRssKib;
+    bool succeeded;
+};
+
+struct Result
+{
+    std::string benchmark;
+    std::string engine;
+    std::vector<double> seconds;
+    long peakRssKib;
+};
+
+[[noreturn]] static void usage()
+{
+    fmt::println(stderr,
+                 "Usage: lox-bench [--lox=path] [--engine=tree|vm] [--runs=n] [--warmup=n] [--output=file] "
+                 "[benchmark...]");
+    std::exit(1);
+}
+
+static int countValue(std::string_view arg)
+{
+    const auto text = arg.substr(arg.find('=') + 1);
+    int value = 0;
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (ec != std::errc() || end != text.data() + text.size() || value < 0)
+        usage();
+    return value;
+}
+
+// Declarations that are never called, so only scanning, parsing and resolving is measured.
+static void generateParseInput(const fs::path& path, int functions)
+{
+    std::ofstream file(path);
+    for (int i = 0; i < functions; i++)
+    {
+        file << fmt::format("fun f{0}(a, b) {{\n"
+                            "  var x = a + b * {0};\n"
+                            "  if (x > 10 and b < 3) {{ x = x - 1; }} else {{ x = x + \"s{0}\"; }}\n"
+                            "  for (var j = 0; j < 3; j = j + 1) {{ print x.field.other(j, {0}.5); }}\n"
+                            "  // A comment on function {0}.\n"
+                            "  return x;\n"
+                            "}}\n",
+                            i);
+    }
+    file << "print \"parsed\";\n";
+}
+
+static Run runOnce(const std::string& lox, const std::string& engine, const fs::path& script)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        // Benchmarks print their results, only failures are of interest.
+        const int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        const auto engineArg = "--engine=" + engine;
+        execl(lox.c_str(), lox.c_str(), engineArg.c_str(), script.c_str(), nullptr);
+        std::perror(lox.c_str());
+        _exit(127);
+    }
+
+    int status = 0;
+    rusage usage{};
+    if (pid < 0 || wait4(pid, &status, 0, &usage) < 0)
+        return {0, 0, false};
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    // ru_maxrss is in KiB on Linux.
+    return {elapsed.count(), usage.ru_maxrss, WIFEXITED(status) && WEXITSTATUS(status) == 0};
+}
+
+static double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    const size_t middle = values.size() / 2;
+    return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+}
+
+static std::string toJson(const std::vector<Result>& results, int runs)
+{
+    std::string json = fmt::format("{{\n  \"runs\": {},\n  \"results\": [", runs);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const auto& result = results[i];
+        json += fmt::format("{}\n    {{\n"
+                            "      \"benchmark\": \"{}\",\n"
+                            "      \"engine\": \"{}\",\n"
+                            "      \"median_seconds\": {:.6f},\n"
+                            "      \"min_seconds\": {:.6f},\n"
+                            "      \"peak_rss_kib\": {},\n"
+                            "      \"seconds\": [{:.6f}]\n"
+                            "    }}",
+                            i ? "," : "",
+                            result.benchmark,
+                            result.engine,
+                            median(result.seconds),
+                            *std::min_element(result.seconds.begin(), result.seconds.end()),
+                            result.peakRssKib,
+                            fmt::join(result.seconds, ", "));
+    }
+    json += "\n  ]\n}\n";
+    return json;
+}
+
+int main(int argc, char** argv)
+{
+    std::string lox = "build/debug/lox";
+    std::vector<std::string> engines;
+    std::vector<std::string> names;
+    int runs = 5;
+    int warmup = 1;
+    const char* output = nullptr;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+        if (arg.starts_with("--lox="))
+            lox = arg.substr(arg.find('=') + 1);
+        else if (arg == "--engine=tree" || arg == "--engine=vm")
+            engines.emplace_back(arg.substr(arg.find('=') + 1));
+        else if (arg.starts_with("--runs="))
+            runs = std::max(countValue(arg), 1);
+        else if (arg.starts_with("--warmup="))
+            warmup = countValue(arg);
+        else if (arg.starts_with("--output="))
+            output = argv[i] + arg.find('=') + 1;
+        else if (!arg.starts_with("--"))
+            names.emplace_back(arg);
+        else
+            usage();
+    }
+    if (engines.empty())
+        engines = {"tree", "vm"};
+
+    std::vector<Benchmark> benchmarks;
+    for (const auto& entry : fs::directory_iterator(LOX_BENCH_DIR))
+    {
+        if (entry.path().extension() == ".lox")
+            benchmarks.push_back({entry.path().stem().string(), entry.path()});
+    }
+    std::sort(benchmarks.begin(), benchmarks.end(), [](const auto& a, const auto& b) { return a.name < b.name; });
+
+    const auto parseInput = fs::temp_directory_path() / fmt::format("lox-bench-parse-{}.lox", getpid());
+    generateParseInput(parseInput, 20000);
+    benchmarks.push_back({"parse", parseInput});
+
+    if (!names.empty())
+    {
+        for (const auto& name : names)
+        {
+            if (std::none_of(benchmarks.begin(), benchmarks.end(), [&](const auto& b) { return b.name == name; }))
+            {
+                fmt::println(stderr, "Unknown benchmark '{}'.", name);
+                fs::remove(parseInput);
+                return 1;
+            }
+        }
+        std::erase_if(benchmarks,
+                      [&](const auto& b) { return std::find(names.begin(), names.end(), b.name) == names.end(); });
+    }
+
+    std::vector<Result> results;
+    bool failed = false;
+    for (const auto& benchmark : benchmarks)
+    {
+        for (const auto& engine : engines)
+        {
+            for (int i = 0; i < warmup; i++)
+                runOnce(lox, engine, benchmark.script);
+
+            Result result{benchmark.name, engine, {}, 0};
+            for (int i = 0; i < runs; i++)
+            {
+                const Run run = runOnce(lox, engine, benchmark.script);
+                if (!run.succeeded)
+                {
+                    fmt::println(stderr, "{} ({}) failed.", benchmark.name, engine);
+                    failed = true;
+                    break;
+                }
+                result.seconds.push_back(run.seconds);
+                result.peakRssKib = std::max(result.peakRssKib, run.peakRssKib);
+            }
+
+            if (result.seconds.size() == static_cast<size_t>(runs))
+            {
+                fmt::println(stderr,
+                             "{} ({}): median {:.3f}s, min {:.3f}s, peak RSS {} KiB",
+                             benchmark.name,
+                             engine,
+                             median(result.seconds),
+                             *std::min_element(result.seconds.begin(), result.seconds.end()),
+                             result.peakRssKib);
+                results.push_back(std::move(result));
+            }
+        }
+    }
+    fs::remove(parseInput);
+
+    const std::string json = toJson(results, runs);
+    if (output)
+        std::ofstream(output) << json;
+    else
+        fmt::print("{}", json);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,184 @@
+#include "pch.hpp"
+
+#include "heap.hpp"
+#include "value.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// With SSE2 the bulk operations go through the numbers two per register, and sums through eight
+// at a time in four registers, finishing the rest one by one. Partial sums are added up at the
+// end, an order of additions that may round differently from adding the numbers one by one.
+
+#ifdef __SSE2__
+static double addLanes(__m128d a, __m128d b, __m128d c, __m128d d)
+{
+    const auto sums = _mm_add_pd(_mm_add_pd(a, b), _mm_add_pd(c, d));
+    return _mm_cvtsd_f64(_mm_add_sd(sums, _mm_unpackhi_pd(sums, sums)));
+}
+#endif
+
+LoxArray::LoxArray(std::span<const Value> elements) : Obj(Type::Array)
+{
+    // Not through push, the heap counts the buffers the array is created with itself.
+    m_nonNumbers = std::ranges::count_if(elements, [](const Value& element) { return !element.isNumber(); });
+    if (m_nonNumbers == 0)
+    {
+        m_numbers.reserve(elements.size());
+        for (const auto& element : elements)
+            m_numbers.push_back(element.getNumber());
+    }
+    else
+    {
+        m_numeric = false;
+        m_values.assign(elements.begin(), elements.end());
+    }
+    m_countedBytes = bufferBytes();
+}
+
+void LoxArray::fill(const Value& value)
+{
+    if (!value.isNumber())
+    {
+        box();
+        std::fill(m_values.begin(), m_values.end(), value);
+        m_nonNumbers = m_values.size();
+        return;
+    }
+
+    if (!m_numeric)
+    {
+        m_numbers.resize(m_values.size());
+        m_values = {};
+        m_numeric = true;
+        recount();
+    }
+    const double number = value.getNumber();
+    double* it = m_numbers.data();
+    double* end = it + m_numbers.size();
+#ifdef __SSE2__
+    const auto numbers = _mm_set1_pd(number);
+    for (; end - it >= 2; it += 2)
+        _mm_storeu_pd(it, numbers);
+#endif
+    for (; it != end; it++)
+        *it = number;
+}
+
+double LoxArray::sum() const
+{
+    assert(m_numeric);
+    const double* it = m_numbers.data();
+    const double* end = it + m_numbers.size();
+    double sum = 0;
+#ifdef __SSE2__
+    auto a = _mm_setzero_pd(), b = a, c = a, d = a;
+    for (; end - it >= 8; it += 8)
+    {
+        a = _mm_add_pd(a, _mm_loadu_pd(it));
+        b = _mm_add_pd(b, _mm_loadu_pd(it + 2));
+        c = _mm_add_pd(c, _mm_loadu_pd(it + 4));
+        d = _mm_add_pd(d, _mm_loadu_pd(it + 6));
+    }
+    sum = addLanes(a, b, c, d);
+#endif
+    for (; it != end; it++)
+        sum += *it;
+    return sum;
+}
+
+double LoxArray::dot(const LoxArray& other) const
+{
+    assert(m_numeric && other.m_numeric && size() == other.size());
+    const double* it = m_numbers.data();
+    const double* end = it + m_numbers.size();
+    const double* otherIt = other.m_numbers.data();
+    double sum = 0;
+#ifdef __SSE2__
+    auto a = _mm_setzero_pd(), b = a, c = a, d = a;
+    for (; end - it >= 8; it += 8, otherIt += 8)
+    {
+        a = _mm_add_pd(a, _mm_mul_pd(_mm_loadu_pd(it), _mm_loadu_pd(otherIt)));
+        b = _mm_add_pd(b, _mm_mul_pd(_mm_loadu_pd(it + 2), _mm_loadu_pd(otherIt + 2)));
+        c = _mm_add_pd(c, _mm_mul_pd(_mm_loadu_pd(it + 4), _mm_loadu_pd(otherIt + 4)));
+        d = _mm_add_pd(d, _mm_mul_pd(_mm_loadu_pd(it + 6), _mm_loadu_pd(otherIt + 6)));
+    }
+    sum = addLanes(a, b, c, d);
+#endif
+    for (; it != end; it++, otherIt++)
+        sum += *it * *otherIt;
+    return sum;
+}
+
+void LoxArray::scale(double factor)
+{
+    assert(m_numeric);
+    double* it = m_numbers.data();
+    double* end = it + m_numbers.size();
+#ifdef __SSE2__
+    const auto factors = _mm_set1_pd(factor);
+    for (; end - it >= 2; it += 2)
+        _mm_storeu_pd(it, _mm_mul_pd(_mm_loadu_pd(it), factors));
+#endif
+    for (; it != end; it++)
+        *it *= factor;
+}
+
+bool LoxArray::makeNumeric()
+{
+    if (m_numeric)
+        return true;
+    if (m_nonNumbers > 0)
+        return false;
+
+    m_numbers.reserve(m_values.capacity());
+    for (const auto& value : m_values)
+        m_numbers.push_back(value.getNumber());
+    m_values = {};
+    m_numeric = true;
+    recount();
+    return true;
+}
+
+void LoxArray::box()
+{
+    if (!m_numeric)
+        return;
+    m_values.reserve(std::max(m_numbers.capacity(), m_numbers.size() + 1));
+    for (double number : m_numbers)
+        m_values.emplace_back(number);
+    m_numbers = {};
+    m_numeric = false;
+    m_nonNumbers = 0;
+    recount();
+}
+
+void LoxArray::resized()
+{
+    const size_t bytes = bufferBytes();
+    Heap::get().resize(*this, m_countedBytes, bytes);
+    m_countedBytes = bytes;
+}
+
+std::string LoxArray::toString() const
+{
+    if (m_printing)
+        return "[...]";
+    m_printing = true;
+    std::string result = "[";
+    for (size_t i = 0; i < size(); i++)
+    {
+        if (i > 0)
+            result += ", ";
+        result += format_as(at(i));
+    }
+    m_printing = false;
+    return result + "]";
+}
+
+void LoxArray::trace(Heap& heap) const
+{
+    for (const auto& value : m_values)
+        heap.mark(value);
+}
@@ -0,0 +1,40 @@
+#include "pch.hpp"
+
+#include "ast.hpp"
+
+#include "scanner.hpp"
+
+Ast::Ast(Source source, ErrorReporter& errors)
+    : source(std::move(source)), tokens(Scanner::scanTokens(this->source.text(), errors))
+{
+}
+
+Ast::~Ast()
+{
+    for (const auto& destructor : m_destructors)
+        destructor.destroy(destructor.node);
+}
+
+LoxString* Ast::symbol(const Token& name)
+{
+    auto& symbol = m_symbols[name.lexeme];
+    if (!symbol)
+        symbol = LoxString::intern(name.lexeme);
+    return symbol.get();
+}
+
+void* Ast::allocate(size_t size, size_t alignment)
+{
+    auto* start = reinterpret_cast<std::byte*>((reinterpret_cast<uintptr_t>(m_next) + alignment - 1) & ~(alignment - 1));
+    if (!m_next || start + size > m_end)
+    {
+        // Lists longer than a block get a block of their own.
+        const size_t blockSize = std::max(size, BlockSize);
+        m_blocks.push_back(std::make_unique_for_overwrite<std::byte[]>(blockSize));
+        start = m_blocks.back().get();
+        m_end = start + blockSize;
+    }
+
+    m_next = start + size;
+    return start;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "error.hpp"
+#include "expr.hpp"
+#include "source.hpp"
+#include "stmt.hpp"
+#include "token.hpp"
+
+// A parsed script: its source, the tokens viewing into it and the syntax tree referring to them.
+// Nodes are allocated one after another in large blocks, so a tree is contiguous in memory and
+// freed all at once. Engines keep the Ast alive for as long as they run code declared in it.
+class Ast
+{
+public:
+    // Scans the source, the Parser fills in the tree.
+    Ast(Source source, ErrorReporter& errors);
+    Ast(const Ast&) = delete;
+    Ast& operator=(const Ast&) = delete;
+    ~Ast();
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args)
+    {
+        T* node = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        // Most nodes only hold pointers into the Ast and need no destructor.
+        if constexpr (!std::is_trivially_destructible_v<T>)
+            m_destructors.push_back({node, [](void* node) { static_cast<T*>(node)->~T(); }});
+        m_nodeCount++;
+        return node;
+    }
+
+    // Copies a list of children built up while parsing into the arena.
+    template <typename T>
+    NodeList<T> list(const std::vector<T*>& nodes)
+    {
+        auto** items = static_cast<T**>(allocate(nodes.size() * sizeof(T*), alignof(T*)));
+        std::copy(nodes.begin(), nodes.end(), items);
+        return {items, nodes.size()};
+    }
+
+    // Interns the name of a variable, field or method, the key the engines look it up by. The
+    // Ast keeps each name alive once, rather than every token holding on to its own.
+    LoxString* symbol(const Token& name);
+
+    size_t nodeCount() const { return m_nodeCount; }
+
+    // Never change once scanned, nodes refer to the tokens they came from.
+    const Source source;
+    const std::vector<Token> tokens;
+    NodeList<Stmt> statements;
+
+private:
+    static constexpr size_t BlockSize = 64 * 1024;
+
+    struct Destructor
+    {
+        void* node;
+        void (*destroy)(void* node);
+    };
+
+    void* allocate(size_t size, size_t alignment);
+
+    std::vector<std::unique_ptr<std::byte[]>> m_blocks;
+    std::byte* m_next = nullptr;
+    std::byte* m_end = nullptr;
+    std::vector<Destructor> m_destructors;
+    std::unordered_map<std::string_view, Ref<LoxString>> m_symbols;
+    size_t m_nodeCount = 0;
+};
@@ -0,0 +1,494 @@
+#include "pch.hpp"
+
+#include "cache.hpp"
+
+#include "vm.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <random>
+
+namespace fs = std::filesystem;
+
+// An entry is a header followed by the global names the bytecode refers to by slot and the
+// script function, which holds its nested functions. Numbers are stored in the byte order of
+// the machine, entries are never shared between binaries anyway. The tokens kept for runtime
+// errors are stored with their lexeme as an offset into the source and the number of code bytes
+// they are the token of, which follow each other as tokens are only ever appended. They make up
+// most of an entry, so their fields are varints relative to the previous token.
+//
+// Bump when the layout of an entry changes. Changes to the bytecode itself are caught by its
+// version, which keys entries along with the source.
+static constexpr uint32_t FormatVersion = 2;
+static_assert(OpCodeCount == 42, "The opcodes changed: bump BytecodeVersion, then update the count here");
+static constexpr char Magic[4] = {'L', 'O', 'X', 'C'};
+
+namespace
+{
+
+struct Header
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t bytecode;
+    uint64_t sourceSize;
+    uint64_t sourceHash;
+};
+
+enum class ConstantTag : uint8_t
+{
+    Number,
+    String,
+};
+
+// Thrown by the reader on an entry that is truncated or doesn't match the source.
+struct Corrupt
+{
+};
+
+class Writer
+{
+public:
+    template <typename T>
+    void write(const T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        m_bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    // LEB128, seven bits per byte.
+    void writeVarint(uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            m_bytes.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        m_bytes.push_back(static_cast<char>(value));
+    }
+
+    void writeSignedVarint(int64_t value) { writeVarint(static_cast<uint64_t>(value) << 1 ^ (value >> 63)); }
+
+    void writeString(std::string_view string)
+    {
+        write(static_cast<uint32_t>(string.size()));
+        m_bytes.append(string);
+    }
+
+    const std::string& bytes() const { return m_bytes; }
+
+private:
+    std::string m_bytes;
+};
+
+class Reader
+{
+public:
+    explicit Reader(std::string_view bytes) : m_bytes(bytes) {}
+
+    template <typename T>
+    T read()
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T value;
+        std::memcpy(&value, take(sizeof(T)).data(), sizeof(T));
+        return value;
+    }
+
+    uint64_t readVarint()
+    {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            const auto byte = read<uint8_t>();
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        throw Corrupt();
+    }
+
+    int64_t readSignedVarint()
+    {
+        const uint64_t value = readVarint();
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    std::string_view readString() { return take(read<uint32_t>()); }
+
+    std::string_view take(size_t size)
+    {
+        if (size > m_bytes.size())
+            throw Corrupt();
+        auto bytes = m_bytes.substr(0, size);
+        m_bytes.remove_prefix(size);
+        return bytes;
+    }
+
+    bool atEnd() const { return m_bytes.empty(); }
+
+private:
+    std::string_view m_bytes;
+};
+
+uint64_t sourceHash(std::string_view source)
+{
+    return std::hash<std::string_view>()(source);
+}
+
+} // namespace
+
+class ChunkSerializer
+{
+public:
+    static void write(Writer& out, const VmFunction& function, std::string_view source);
+    static std::shared_ptr<VmFunction> read(Reader& in, std::string_view source, size_t globalCount);
+
+private:
+    static void verify(const VmFunction& function, size_t globalCount);
+};
+
+void ChunkSerializer::write(Writer& out, const VmFunction& function, std::string_view source)
+{
+    const auto& chunk = function.chunk;
+    out.writeString(function.name);
+    out.write(static_cast<int32_t>(function.arity));
+    out.write(static_cast<int32_t>(function.upvalueCount));
+
+    out.write(static_cast<uint32_t>(chunk.code.size()));
+    out.writeString({reinterpret_cast<const char*>(chunk.code.data()), chunk.code.size()});
+
+    out.write(static_cast<uint32_t>(chunk.constants.size()));
+    for (const auto& constant : chunk.constants)
+    {
+        // Literals are the only constants.
+        assert(constant.isNumber() || constant.isString());
+        if (constant.isNumber())
+        {
+            out.write(ConstantTag::Number);
+            out.write(constant.getNumber());
+        }
+        else
+        {
+            out.write(ConstantTag::String);
+            out.writeString(constant.getString());
+        }
+    }
+
+    out.write(static_cast<uint32_t>(chunk.names.size()));
+    for (const auto& name : chunk.names)
+        out.writeString(name->chars);
+
+    out.write(static_cast<uint32_t>(chunk.caches.size()));
+
+    // Code bytes written before the first token have none.
+    std::vector<uint32_t> runs(chunk.m_tokens.size() + 1);
+    for (int index : chunk.m_tokenIndices)
+        runs[index + 1]++;
+    out.write(static_cast<uint32_t>(chunk.m_tokens.size()));
+    out.write(runs[0]);
+    int64_t offset = 0;
+    int line = 0;
+    for (size_t i = 0; i < chunk.m_tokens.size(); i++)
+    {
+        const auto& token = chunk.m_tokens[i];
+        const int64_t tokenOffset = token.lexeme.data() - source.data();
+        out.write(static_cast<uint8_t>(token.type));
+        out.writeSignedVarint(token.line - line);
+        out.writeSignedVarint(tokenOffset - offset);
+        out.writeVarint(token.lexeme.size());
+        out.writeVarint(runs[i + 1]);
+        offset = tokenOffset;
+        line = token.line;
+    }
+
+    out.write(static_cast<uint32_t>(chunk.functions.size()));
+    for (const auto& nested : chunk.functions)
+        write(out, *nested, source);
+}
+
+std::shared_ptr<VmFunction> ChunkSerializer::read(Reader& in, std::string_view source, size_t globalCount)
+{
+    auto function = std::make_shared<VmFunction>(in.readString());
+    auto& chunk = function->chunk;
+    function->arity = in.read<int32_t>();
+    function->upvalueCount = in.read<int32_t>();
+
+    const auto codeSize = in.read<uint32_t>();
+    const auto code = in.readString();
+    if (code.size() != codeSize)
+        throw Corrupt();
+    chunk.code.assign(code.begin(), code.end());
+
+    const auto constantCount = in.read<uint32_t>();
+    for (uint32_t i = 0; i < constantCount; i++)
+    {
+        if (in.read<ConstantTag>() == ConstantTag::Number)
+            chunk.addConstant(Value(in.read<double>()));
+        else
+            chunk.addConstant(Value(LoxString::intern(in.readString())));
+    }
+
+    const auto nameCount = in.read<uint32_t>();
+    for (uint32_t i = 0; i < nameCount; i++)
+        chunk.addName(LoxString::intern(in.readString()));
+
+    const auto cacheCount = in.read<uint32_t>();
+    chunk.caches.resize(cacheCount);
+
+    const auto tokenCount = in.read<uint32_t>();
+    const auto untokened = in.read<uint32_t>();
+    if (untokened > chunk.code.size())
+        throw Corrupt();
+    chunk.m_tokens.reserve(tokenCount);
+    chunk.m_tokenIndices.reserve(chunk.code.size());
+    chunk.m_tokenIndices.assign(untokened, -1);
+    int64_t offset = 0;
+    int line = 0;
+    for (uint32_t i = 0; i < tokenCount; i++)
+    {
+        const auto type = static_cast<TokenType>(in.read<uint8_t>());
+        line += static_cast<int>(in.readSignedVarint());
+        offset += in.readSignedVarint();
+        const auto size = in.readVarint();
+        const auto run = in.readVarint();
+        if (type > TokenType::Eof || offset < 0 || static_cast<uint64_t>(offset) > source.size() ||
+            size > source.size() - offset || run > chunk.code.size() - chunk.m_tokenIndices.size())
+            throw Corrupt();
+        chunk.m_tokens.emplace_back(type, source.substr(offset, size), line);
+        chunk.m_tokenIndices.insert(chunk.m_tokenIndices.end(), run, static_cast<int>(i));
+    }
+    if (chunk.m_tokenIndices.size() != chunk.code.size())
+        throw Corrupt();
+
+    const auto functionCount = in.read<uint32_t>();
+    for (uint32_t i = 0; i < functionCount; i++)
+        chunk.addFunction(read(in, source, globalCount));
+
+    verify(*function, globalCount);
+    return function;
+}
+
+// Checks the operands of every instruction against the chunk, its function and the globals, so
+// bytecode from a damaged entry is rejected instead of reading out of bounds when it runs. Jumps
+// have to land on an instruction, and the code has to end with a return not to run off its end.
+void ChunkSerializer::verify(const VmFunction& function, size_t globalCount)
+{
+    auto check = [](bool valid)
+    {
+        if (!valid)
+            throw Corrupt();
+    };
+    check(function.arity >= 0 && function.arity <= 255);
+    check(function.upvalueCount >= 0 && function.upvalueCount <= 255);
+
+    const auto& chunk = function.chunk;
+    const auto& code = chunk.code;
+    size_t offset = 0;
+    auto readByte = [&]() -> size_t
+    {
+        check(offset < code.size());
+        return code[offset++];
+    };
+    auto readShort = [&]() -> size_t
+    {
+        const size_t high = readByte();
+        return high << 8 | readByte();
+    };
+
+    std::vector<bool> starts(code.size());
+    std::vector<size_t> targets;
+    auto last = OpCode::Nil;
+    while (offset < code.size())
+    {
+        starts[offset] = true;
+        const size_t byte = readByte();
+        check(byte < OpCodeCount);
+        last = static_cast<OpCode>(byte);
+        switch (last)
+        {
+        case OpCode::Constant:
+            check(readShort() < chunk.constants.size());
+            break;
+        case OpCode::GetGlobal:
+        case OpCode::DefineGlobal:
+        case OpCode::SetGlobal:
+            check(readShort() < globalCount);
+            break;
+        case OpCode::GetUpvalue:
+        case OpCode::SetUpvalue:
+            check(readByte() < static_cast<size_t>(function.upvalueCount));
+            break;
+        case OpCode::GetLocal:
+        case OpCode::SetLocal:
+        case OpCode::Call:
+        case OpCode::TailCall:
+        case OpCode::Array:
+            readByte();
+            break;
+        case OpCode::GetProperty:
+        case OpCode::SetProperty:
+            check(readShort() < chunk.names.size());
+            check(readShort() < chunk.caches.size());
+            break;
+        case OpCode::Invoke:
+        case OpCode::TailInvoke:
+            check(readShort() < chunk.names.size());
+            check(readShort() < chunk.caches.size());
+            readByte();
+            break;
+        case OpCode::Class:
+        case OpCode::Method:
+            check(readShort() < chunk.names.size());
+            break;
+        case OpCode::Jump:
+        case OpCode::JumpIfFalse:
+        {
+            const size_t jump = readShort();
+            targets.push_back(offset + jump);
+            break;
+        }
+        case OpCode::Loop:
+        {
+            const size_t jump = readShort();
+            check(jump <= offset);
+            targets.push_back(offset - jump);
+            break;
+        }
+        case OpCode::Closure:
+        {
+            const size_t index = readShort();
+            check(index < chunk.functions.size());
+            for (int i = 0; i < chunk.functions[index]->upvalueCount; i++)
+            {
+                const size_t isLocal = readByte();
+                const size_t slot = readByte();
+                check(isLocal <= 1 && (isLocal || slot < static_cast<size_t>(function.upvalueCount)));
+            }
+            break;
+        }
+        case OpCode::Nil:
+        case OpCode::True:
+        case OpCode::False:
+        case OpCode::Pop:
+        case OpCode::GetIndex:
+        case OpCode::SetIndex:
+        case OpCode::Equal:
+        case OpCode::NotEqual:
+        case OpCode::Greater:
+        case OpCode::GreaterEqual:
+        case OpCode::Less:
+        case OpCode::LessEqual:
+        case OpCode::Add:
+        case OpCode::Subtract:
+        case OpCode::Multiply:
+        case OpCode::Divide:
+        case OpCode::Not:
+        case OpCode::Negate:
+        case OpCode::Print:
+        case OpCode::CloseUpvalue:
+        case OpCode::Return:
+            break;
+        }
+    }
+
+    check(last == OpCode::Return);
+    for (size_t target : targets)
+        check(target < code.size() && starts[target]);
+}
+
+fs::path ProgramCache::defaultDirectory()
+{
+    if (const char* cache = std::getenv("XDG_CACHE_HOME"); cache && *cache)
+        return fs::path(cache) / "lox";
+    if (const char* home = std::getenv("HOME"); home && *home)
+        return fs::path(home) / ".cache" / "lox";
+    return fs::temp_directory_path() / "lox-cache";
+}
+
+fs::path ProgramCache::entryPath(std::string_view source) const
+{
+    return m_directory / fmt::format("{:016x}.loxc", sourceHash(source));
+}
+
+std::shared_ptr<VmFunction> ProgramCache::load(const Source& source, VM& vm) const
+{
+    const auto text = source.text();
+    const auto entry = Source::load(entryPath(text).c_str());
+    if (!entry)
+        return nullptr;
+
+    try
+    {
+        Reader in(entry->text());
+        const auto header = in.read<Header>();
+        if (std::memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != FormatVersion ||
+            header.bytecode != BytecodeVersion || header.sourceSize != text.size() ||
+            header.sourceHash != sourceHash(text))
+            return nullptr;
+
+        // Global operands are the slots the compiling VM gave the names. This VM has to have
+        // given the globals it already knows the same slots; the others are added in order.
+        const auto globalCount = in.read<uint32_t>();
+        std::vector<std::string_view> globals(globalCount);
+        for (auto& name : globals)
+            name = in.readString();
+        const auto& known = vm.globalNames();
+        if (known.size() > globals.size() || !std::equal(known.begin(), known.end(), globals.begin()))
+            return nullptr;
+
+        auto script = ChunkSerializer::read(in, text, globals.size());
+        if (!in.atEnd())
+            return nullptr;
+
+        for (size_t slot = known.size(); slot < globals.size(); slot++)
+            vm.globalSlot(globals[slot]);
+        return script;
+    }
+    catch (const Corrupt&)
+    {
+        return nullptr;
+    }
+}
+
+void ProgramCache::store(const Source& source, const VmFunction& script, const VM& vm) const
+{
+    const auto text = source.text();
+    if (text.size() > UINT32_MAX)
+        return;
+
+    Writer out;
+    Header header{};
+    std::memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = FormatVersion;
+    header.bytecode = BytecodeVersion;
+    header.sourceSize = text.size();
+    header.sourceHash = sourceHash(text);
+    out.write(header);
+
+    out.write(static_cast<uint32_t>(vm.globalNames().size()));
+    for (const auto& name : vm.globalNames())
+        out.writeString(name);
+
+    ChunkSerializer::write(out, script, text);
+
+    // Written to a temporary file and renamed into place, so a process loading the entry
+    // concurrently never sees it half written.
+    std::error_code error;
+    fs::create_directories(m_directory, error);
+    const auto path = entryPath(text);
+    auto temporary = path;
+    temporary += fmt::format(".{:08x}.tmp", std::random_device()());
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        file.write(out.bytes().data(), out.bytes().size());
+        if (!file)
+        {
+            fs::remove(temporary, error);
+            return;
+        }
+    }
+    fs::rename(temporary, path, error);
+    if (error)
+        fs::remove(temporary, error);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "chunk.hpp"
+#include "source.hpp"
+
+#include <filesystem>
+
+class VM;
+
+// Bytecode of scripts kept on disk, so running a script that hasn't changed skips scanning,
+// parsing, resolving and compiling it. Entries are named by the hash of the source and are only
+// used by builds of the same BytecodeVersion.
+class ProgramCache
+{
+public:
+    explicit ProgramCache(std::filesystem::path directory) : m_directory(std::move(directory)) {}
+
+    // $XDG_CACHE_HOME/lox, else ~/.cache/lox, else lox-cache in the temporary directory.
+    static std::filesystem::path defaultDirectory();
+
+    // The script compiled from this source, or null if there is no usable entry. The tokens of
+    // the bytecode view into the source, which has to outlive it.
+    std::shared_ptr<VmFunction> load(const Source& source, VM& vm) const;
+    // Writing is best effort, a directory that can't be written to just means no caching.
+    void store(const Source& source, const VmFunction& script, const VM& vm) const;
+
+private:
+    std::filesystem::path entryPath(std::string_view source) const;
+
+    std::filesystem::path m_directory;
+};
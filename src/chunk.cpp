@@ -0,0 +1,55 @@
+#include "pch.hpp"
+
+#include "chunk.hpp"
+
+void Chunk::write(uint8_t byte, const Token& token)
+{
+    if (&token != m_lastToken)
+    {
+        m_tokens.push_back(token);
+        m_lastToken = &token;
+    }
+
+    write(byte);
+}
+
+void Chunk::write(uint8_t byte)
+{
+    code.push_back(byte);
+    m_tokenIndices.push_back(static_cast<int>(m_tokens.size()) - 1);
+}
+
+int Chunk::addConstant(const Value& value)
+{
+    constants.push_back(value);
+    if (value.isObject())
+        m_pinned.emplace_back(value.getObject());
+    return constants.size() - 1;
+}
+
+int Chunk::addName(LoxString* name)
+{
+    auto [it, inserted] = m_nameIndices.try_emplace(name, names.size());
+    if (inserted)
+        names.push_back(name);
+    return it->second;
+}
+
+int Chunk::addFunction(std::shared_ptr<VmFunction> function)
+{
+    functions.push_back(std::move(function));
+    return functions.size() - 1;
+}
+
+int Chunk::addCache()
+{
+    caches.emplace_back();
+    return caches.size() - 1;
+}
+
+const Token& Chunk::tokenAt(int offset) const
+{
+    assert(offset >= 0 && offset < m_tokenIndices.size());
+    assert(m_tokenIndices[offset] >= 0);
+    return m_tokens[m_tokenIndices[offset]];
+}
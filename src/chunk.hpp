@@ -0,0 +1,105 @@
+#pragma once
+
+#include "token.hpp"
+#include "value.hpp"
+
+enum class OpCode : uint8_t
+{
+    Constant,     // u16 constant
+    Nil,
+    True,
+    False,
+    Pop,
+    GetLocal,     // u8 slot
+    SetLocal,     // u8 slot
+    GetGlobal,    // u16 global
+    DefineGlobal, // u16 global
+    SetGlobal,    // u16 global
+    GetUpvalue,   // u8 upvalue
+    SetUpvalue,   // u8 upvalue
+    GetProperty,  // u16 name, u16 cache
+    SetProperty,  // u16 name, u16 cache
+    GetIndex,
+    SetIndex,
+    Array,        // u8 element count
+    Equal,
+    NotEqual,
+    Greater,
+    GreaterEqual,
+    Less,
+    LessEqual,
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Not,
+    Negate,
+    Print,
+    Jump,         // u16 forward offset
+    JumpIfFalse,  // u16 forward offset, leaves the condition on the stack
+    Loop,         // u16 backward offset
+    Call,         // u8 argument count
+    Invoke,       // u16 name, u16 cache, u8 argument count
+    // Like Call and Invoke, but a closure called replaces the calling frame. Followed by Return,
+    // which returns the result of anything else.
+    TailCall,     // u8 argument count
+    TailInvoke,   // u16 name, u16 cache, u8 argument count
+    Closure,      // u16 function, then (u8 isLocal, u8 index) per upvalue
+    CloseUpvalue,
+    Return,
+    Class,        // u16 name
+    Method,       // u16 name
+};
+
+inline constexpr int OpCodeCount = static_cast<int>(OpCode::Method) + 1;
+
+// Identifies the bytecode: bump when an opcode is added, removed or reordered, or its operands or
+// what it does change. The cache only loads bytecode written by a build of the same version.
+inline constexpr uint32_t BytecodeVersion = 1;
+
+class VmFunction;
+
+class Chunk
+{
+public:
+    void write(uint8_t byte, const Token& token);
+    void write(uint8_t byte);
+    void write(OpCode op, const Token& token) { write(static_cast<uint8_t>(op), token); }
+    void write(OpCode op) { write(static_cast<uint8_t>(op)); }
+
+    int addConstant(const Value& value);
+    int addName(LoxString* name);
+    int addFunction(std::shared_ptr<VmFunction> function);
+    int addCache();
+
+    // Source token of the instruction byte at offset, used to report runtime errors.
+    const Token& tokenAt(int offset) const;
+
+    std::vector<uint8_t> code;
+    // Object constants are pinned for as long as the chunk exists.
+    std::vector<Value> constants;
+    std::vector<Ref<LoxString>> names;
+    std::vector<std::shared_ptr<VmFunction>> functions;
+    // Inline caches of the property instructions, filled in as they run.
+    mutable std::vector<PropertyCache> caches;
+
+private:
+    friend class ChunkSerializer;
+
+    std::vector<Token> m_tokens;
+    std::vector<int> m_tokenIndices;
+    const Token* m_lastToken = nullptr;
+    StringMap<int> m_nameIndices;
+    std::vector<Ref<Obj>> m_pinned;
+};
+
+class VmFunction
+{
+public:
+    VmFunction(std::string_view name) : name(name) {}
+
+    std::string name;
+    int arity = 0;
+    int upvalueCount = 0;
+    Chunk chunk;
+};
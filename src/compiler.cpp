@@ -0,0 +1,657 @@
+#include "pch.hpp"
+
+#include "compiler.hpp"
+
+#include "vm.hpp"
+
+static constexpr int MaxLocals = UINT8_MAX + 1;
+static constexpr int MaxOperand = UINT16_MAX;
+
+std::shared_ptr<VmFunction> Compiler::compile(VM& vm, NodeList<Stmt> statements, ErrorReporter& errors)
+{
+    Compiler compiler(vm, errors);
+
+    FunctionScope script{nullptr, std::make_shared<VmFunction>("script"), FunctionType::Script};
+    script.locals.push_back({"", 0});
+    compiler.m_current = &script;
+
+    for (const auto& stmt : statements)
+        compiler.compileStmt(*stmt);
+    compiler.emitReturn();
+
+    return script.function;
+}
+
+void Compiler::compileStmt(const Stmt& stmt)
+{
+    switch (stmt.kind)
+    {
+    case Stmt::Kind::Expression:
+        return compileExpressionStmt(static_cast<const Stmt::Expression&>(stmt));
+    case Stmt::Kind::Print:
+        return compilePrintStmt(static_cast<const Stmt::Print&>(stmt));
+    case Stmt::Kind::Var:
+        return compileVarStmt(static_cast<const Stmt::Var&>(stmt));
+    case Stmt::Kind::Block:
+        return compileBlockStmt(static_cast<const Stmt::Block&>(stmt));
+    case Stmt::Kind::If:
+        return compileIfStmt(static_cast<const Stmt::If&>(stmt));
+    case Stmt::Kind::While:
+        return compileWhileStmt(static_cast<const Stmt::While&>(stmt));
+    case Stmt::Kind::For:
+        return compileForStmt(static_cast<const Stmt::For&>(stmt));
+    case Stmt::Kind::Fun:
+        return compileFunStmt(static_cast<const Stmt::Fun&>(stmt));
+    case Stmt::Kind::Return:
+        return compileReturnStmt(static_cast<const Stmt::Return&>(stmt));
+    case Stmt::Kind::Class:
+        return compileClassStmt(static_cast<const Stmt::Class&>(stmt));
+    }
+
+    assert(0 && "unreachable");
+}
+
+void Compiler::compileExpressionStmt(const Stmt::Expression& stmt)
+{
+    compileExpr(*stmt.expression);
+    emit(OpCode::Pop);
+}
+
+void Compiler::compilePrintStmt(const Stmt::Print& stmt)
+{
+    compileExpr(*stmt.expression);
+    emit(OpCode::Print);
+}
+
+void Compiler::compileVarStmt(const Stmt::Var& stmt)
+{
+    declareVariable(stmt.name);
+    if (stmt.expression)
+        compileExpr(*stmt.expression);
+    else
+        emit(OpCode::Nil, stmt.name);
+    defineVariable(stmt.name);
+}
+
+void Compiler::compileBlockStmt(const Stmt::Block& stmt)
+{
+    beginScope();
+    for (const auto& s : stmt.statements)
+        compileStmt(*s);
+    endScope();
+}
+
+void Compiler::compileIfStmt(const Stmt::If& stmt)
+{
+    compileExpr(*stmt.condition);
+
+    const int elseJump = emitJump(OpCode::JumpIfFalse);
+    emit(OpCode::Pop);
+    compileBody(*stmt.ifBranch);
+    const int endJump = emitJump(OpCode::Jump);
+
+    patchJump(elseJump);
+    emit(OpCode::Pop);
+    if (stmt.elseBranch)
+        compileBody(*stmt.elseBranch);
+    patchJump(endJump);
+}
+
+void Compiler::compileWhileStmt(const Stmt::While& stmt)
+{
+    const int loopStart = chunk().code.size();
+    compileExpr(*stmt.condition);
+
+    const int exitJump = emitJump(OpCode::JumpIfFalse);
+    emit(OpCode::Pop);
+    compileBody(*stmt.body);
+    emitLoop(loopStart);
+
+    patchJump(exitJump);
+    emit(OpCode::Pop);
+}
+
+void Compiler::compileForStmt(const Stmt::For& stmt)
+{
+    // Like the interpreter, the initializer lives in the enclosing scope.
+    if (stmt.initializer)
+        compileStmt(*stmt.initializer);
+
+    const int loopStart = chunk().code.size();
+    int exitJump = -1;
+    if (stmt.condition)
+    {
+        compileExpr(*stmt.condition);
+        exitJump = emitJump(OpCode::JumpIfFalse);
+        emit(OpCode::Pop);
+    }
+
+    compileBody(*stmt.body);
+    if (stmt.step)
+    {
+        compileExpr(*stmt.step);
+        emit(OpCode::Pop);
+    }
+    emitLoop(loopStart);
+
+    if (exitJump != -1)
+    {
+        patchJump(exitJump);
+        emit(OpCode::Pop);
+    }
+}
+
+void Compiler::compileFunStmt(const Stmt::Fun& stmt)
+{
+    declareVariable(stmt.name);
+    // A local function is initialized before its body so that it can call itself.
+    if (m_current->scopeDepth > 0)
+        m_current->locals.back().depth = m_current->scopeDepth;
+    compileFunction(stmt, FunctionType::Function);
+    defineVariable(stmt.name);
+}
+
+void Compiler::compileReturnStmt(const Stmt::Return& stmt)
+{
+    if (stmt.tailCall)
+        compileCallExpr(*stmt.tailCall, true);
+    else if (stmt.value)
+        compileExpr(*stmt.value);
+    else
+        emit(OpCode::Nil, stmt.keyword);
+    emit(OpCode::Return, stmt.keyword);
+}
+
+void Compiler::compileClassStmt(const Stmt::Class& stmt)
+{
+    declareVariable(stmt.name);
+    emit(OpCode::Class, stmt.name);
+    emitShort(nameOperand(stmt.name), stmt.name);
+    defineVariable(stmt.name);
+
+    getVariable(stmt.name);
+    for (const auto& method : stmt.methods)
+    {
+        compileFunction(*method, FunctionType::Method);
+        emit(OpCode::Method, method->name);
+        emitShort(nameOperand(method->name), method->name);
+    }
+    emit(OpCode::Pop);
+}
+
+void Compiler::compileExpr(const Expr& expr)
+{
+    switch (expr.kind)
+    {
+    case Expr::Kind::Binary:
+        return compileBinaryExpr(static_cast<const Expr::Binary&>(expr));
+    case Expr::Kind::Grouping:
+        return compileGroupingExpr(static_cast<const Expr::Grouping&>(expr));
+    case Expr::Kind::Literal:
+        return compileLiteralExpr(static_cast<const Expr::Literal&>(expr));
+    case Expr::Kind::Unary:
+        return compileUnaryExpr(static_cast<const Expr::Unary&>(expr));
+    case Expr::Kind::Variable:
+        return compileVariableExpr(static_cast<const Expr::Variable&>(expr));
+    case Expr::Kind::Assign:
+        return compileAssignExpr(static_cast<const Expr::Assign&>(expr));
+    case Expr::Kind::Logical:
+        return compileLogicalExpr(static_cast<const Expr::Logical&>(expr));
+    case Expr::Kind::Call:
+        return compileCallExpr(static_cast<const Expr::Call&>(expr));
+    case Expr::Kind::Get:
+        return compileGetExpr(static_cast<const Expr::Get&>(expr));
+    case Expr::Kind::Set:
+        return compileSetExpr(static_cast<const Expr::Set&>(expr));
+    case Expr::Kind::This:
+        return compileThisExpr(static_cast<const Expr::This&>(expr));
+    case Expr::Kind::Array:
+        return compileArrayExpr(static_cast<const Expr::Array&>(expr));
+    case Expr::Kind::Index:
+        return compileIndexExpr(static_cast<const Expr::Index&>(expr));
+    case Expr::Kind::SetIndex:
+        return compileSetIndexExpr(static_cast<const Expr::SetIndex&>(expr));
+    }
+
+    assert(0 && "unreachable");
+}
+
+void Compiler::compileBinaryExpr(const Expr::Binary& expr)
+{
+    compileExpr(*expr.left);
+    compileExpr(*expr.right);
+
+    switch (expr.op.type)
+    {
+    case TokenType::Plus:
+        return emit(OpCode::Add, expr.op);
+    case TokenType::Minus:
+        return emit(OpCode::Subtract, expr.op);
+    case TokenType::Star:
+        return emit(OpCode::Multiply, expr.op);
+    case TokenType::Slash:
+        return emit(OpCode::Divide, expr.op);
+    case TokenType::EqualEqual:
+        return emit(OpCode::Equal, expr.op);
+    case TokenType::BangEqual:
+        return emit(OpCode::NotEqual, expr.op);
+    case TokenType::Greater:
+        return emit(OpCode::Greater, expr.op);
+    case TokenType::GreaterEqual:
+        return emit(OpCode::GreaterEqual, expr.op);
+    case TokenType::Less:
+        return emit(OpCode::Less, expr.op);
+    case TokenType::LessEqual:
+        return emit(OpCode::LessEqual, expr.op);
+    default:
+        assert(0 && "unreachable");
+    }
+}
+
+void Compiler::compileGroupingExpr(const Expr::Grouping& expr)
+{
+    compileExpr(*expr.expression);
+}
+
+void Compiler::compileLiteralExpr(const Expr::Literal& expr)
+{
+    const auto& token = expr.token;
+    switch (token.type)
+    {
+    case TokenType::Nil:
+        return emit(OpCode::Nil, token);
+    case TokenType::False:
+        return emit(OpCode::False, token);
+    case TokenType::True:
+        return emit(OpCode::True, token);
+    case TokenType::Number:
+    case TokenType::String:
+        return emitConstant(expr.value, token);
+    default:
+        assert(0 && "unreachable");
+    }
+}
+
+void Compiler::compileUnaryExpr(const Expr::Unary& expr)
+{
+    compileExpr(*expr.right);
+
+    if (expr.op.type == TokenType::Minus)
+        emit(OpCode::Negate, expr.op);
+    else if (expr.op.type == TokenType::Bang)
+        emit(OpCode::Not, expr.op);
+    else
+        assert(0 && "unreachable");
+}
+
+void Compiler::compileVariableExpr(const Expr::Variable& expr)
+{
+    getVariable(expr.name);
+}
+
+void Compiler::compileAssignExpr(const Expr::Assign& expr)
+{
+    compileExpr(*expr.value);
+    setVariable(expr.name);
+}
+
+void Compiler::compileLogicalExpr(const Expr::Logical& expr)
+{
+    compileExpr(*expr.left);
+
+    if (expr.op.type == TokenType::And)
+    {
+        const int endJump = emitJump(OpCode::JumpIfFalse);
+        emit(OpCode::Pop);
+        compileExpr(*expr.right);
+        patchJump(endJump);
+    }
+    else
+    {
+        const int elseJump = emitJump(OpCode::JumpIfFalse);
+        const int endJump = emitJump(OpCode::Jump);
+        patchJump(elseJump);
+        emit(OpCode::Pop);
+        compileExpr(*expr.right);
+        patchJump(endJump);
+    }
+}
+
+void Compiler::compileCallExpr(const Expr::Call& expr, bool tail)
+{
+    // obj.method(args) calls the method directly instead of creating a bound method first.
+    if (expr.callee->kind == Expr::Kind::Get)
+    {
+        const auto& get = static_cast<const Expr::Get&>(*expr.callee);
+        compileExpr(*get.object);
+        compileArguments(expr);
+        emit(tail ? OpCode::TailInvoke : OpCode::Invoke, get.name);
+        emitShort(nameOperand(get.name), get.name);
+        emitShort(cacheOperand(get.name), get.name);
+        emitByte(expr.arguments.size(), expr.paren);
+        return;
+    }
+
+    compileExpr(*expr.callee);
+    compileArguments(expr);
+    emit(tail ? OpCode::TailCall : OpCode::Call, expr.paren);
+    emitByte(expr.arguments.size(), expr.paren);
+}
+
+void Compiler::compileGetExpr(const Expr::Get& expr)
+{
+    compileExpr(*expr.object);
+    emit(OpCode::GetProperty, expr.name);
+    emitShort(nameOperand(expr.name), expr.name);
+    emitShort(cacheOperand(expr.name), expr.name);
+}
+
+void Compiler::compileSetExpr(const Expr::Set& expr)
+{
+    compileExpr(*expr.object);
+    compileExpr(*expr.value);
+    emit(OpCode::SetProperty, expr.name);
+    emitShort(nameOperand(expr.name), expr.name);
+    emitShort(cacheOperand(expr.name), expr.name);
+}
+
+void Compiler::compileThisExpr(const Expr::This& expr)
+{
+    getVariable(expr.keyword);
+}
+
+void Compiler::compileArrayExpr(const Expr::Array& expr)
+{
+    for (const auto* element : expr.elements)
+        compileExpr(*element);
+    emit(OpCode::Array, expr.bracket);
+    emitByte(expr.elements.size(), expr.bracket);
+}
+
+void Compiler::compileIndexExpr(const Expr::Index& expr)
+{
+    compileExpr(*expr.object);
+    compileExpr(*expr.index);
+    emit(OpCode::GetIndex, expr.bracket);
+}
+
+void Compiler::compileSetIndexExpr(const Expr::SetIndex& expr)
+{
+    compileExpr(*expr.object);
+    compileExpr(*expr.index);
+    compileExpr(*expr.value);
+    emit(OpCode::SetIndex, expr.bracket);
+}
+
+void Compiler::compileBody(const Stmt& stmt)
+{
+    // A nested for declares its initializer in the enclosing scope, which would push a local
+    // each time (or only sometimes) the body runs. Give it a scope of its own instead.
+    if (stmt.kind == Stmt::Kind::For && m_current->scopeDepth > 0)
+    {
+        beginScope();
+        compileStmt(stmt);
+        endScope();
+        return;
+    }
+
+    compileStmt(stmt);
+}
+
+void Compiler::compileFunction(const Stmt::Fun& stmt, FunctionType type)
+{
+    FunctionScope scope{m_current, std::make_shared<VmFunction>(stmt.name.lexeme), type};
+    scope.function->arity = stmt.params.size();
+    // Slot zero holds the callee, or the receiver for methods.
+    scope.locals.push_back({type == FunctionType::Method ? "this" : "", 0});
+    scope.scopeDepth = 1;
+    m_current = &scope;
+
+    for (const auto* param : stmt.params)
+    {
+        declareVariable(*param);
+        defineVariable(*param);
+    }
+    for (const auto& s : stmt.body)
+        compileStmt(*s);
+    emitReturn();
+
+    m_current = scope.enclosing;
+    scope.function->upvalueCount = scope.upvalues.size();
+
+    const int index = chunk().addFunction(scope.function);
+    if (index > MaxOperand)
+        m_errors.error(stmt.name, "Too many functions in one chunk.");
+
+    emit(OpCode::Closure, stmt.name);
+    emitShort(index, stmt.name);
+    for (const auto& upvalue : scope.upvalues)
+    {
+        emitByte(upvalue.isLocal ? 1 : 0, stmt.name);
+        emitByte(upvalue.index, stmt.name);
+    }
+}
+
+void Compiler::compileArguments(const Expr::Call& expr)
+{
+    for (const auto& arg : expr.arguments)
+        compileExpr(*arg);
+}
+
+void Compiler::beginScope()
+{
+    m_current->scopeDepth++;
+}
+
+void Compiler::endScope()
+{
+    auto& locals = m_current->locals;
+    m_current->scopeDepth--;
+
+    while (!locals.empty() && locals.back().depth > m_current->scopeDepth)
+    {
+        emit(locals.back().isCaptured ? OpCode::CloseUpvalue : OpCode::Pop);
+        locals.pop_back();
+    }
+}
+
+void Compiler::declareVariable(const Token& name)
+{
+    if (m_current->scopeDepth == 0)
+        return;
+
+    if (m_current->locals.size() == MaxLocals)
+    {
+        m_errors.error(name, "Too many local variables in function.");
+        return;
+    }
+
+    m_current->locals.push_back({name.lexeme, -1});
+}
+
+void Compiler::defineVariable(const Token& name)
+{
+    if (m_current->scopeDepth == 0)
+    {
+        emit(OpCode::DefineGlobal, name);
+        emitShort(globalOperand(name), name);
+        return;
+    }
+
+    m_current->locals.back().depth = m_current->scopeDepth;
+}
+
+void Compiler::getVariable(const Token& name)
+{
+    if (int slot = resolveLocal(*m_current, name); slot != -1)
+    {
+        emit(OpCode::GetLocal, name);
+        emitByte(slot, name);
+    }
+    else if (int upvalue = resolveUpvalue(*m_current, name); upvalue != -1)
+    {
+        emit(OpCode::GetUpvalue, name);
+        emitByte(upvalue, name);
+    }
+    else
+    {
+        emit(OpCode::GetGlobal, name);
+        emitShort(globalOperand(name), name);
+    }
+}
+
+void Compiler::setVariable(const Token& name)
+{
+    if (int slot = resolveLocal(*m_current, name); slot != -1)
+    {
+        emit(OpCode::SetLocal, name);
+        emitByte(slot, name);
+    }
+    else if (int upvalue = resolveUpvalue(*m_current, name); upvalue != -1)
+    {
+        emit(OpCode::SetUpvalue, name);
+        emitByte(upvalue, name);
+    }
+    else
+    {
+        emit(OpCode::SetGlobal, name);
+        emitShort(globalOperand(name), name);
+    }
+}
+
+int Compiler::resolveLocal(FunctionScope& scope, const Token& name)
+{
+    for (int i = scope.locals.size() - 1; i >= 0; i--)
+    {
+        if (scope.locals[i].name == name.lexeme)
+            return i;
+    }
+
+    return -1;
+}
+
+int Compiler::resolveUpvalue(FunctionScope& scope, const Token& name)
+{
+    if (!scope.enclosing)
+        return -1;
+
+    if (int local = resolveLocal(*scope.enclosing, name); local != -1)
+    {
+        scope.enclosing->locals[local].isCaptured = true;
+        return addUpvalue(scope, local, true, name);
+    }
+
+    if (int upvalue = resolveUpvalue(*scope.enclosing, name); upvalue != -1)
+        return addUpvalue(scope, upvalue, false, name);
+
+    return -1;
+}
+
+int Compiler::addUpvalue(FunctionScope& scope, uint8_t index, bool isLocal, const Token& name)
+{
+    for (int i = 0; i < scope.upvalues.size(); i++)
+    {
+        if (scope.upvalues[i].index == index && scope.upvalues[i].isLocal == isLocal)
+            return i;
+    }
+
+    if (scope.upvalues.size() == MaxLocals)
+    {
+        m_errors.error(name, "Too many closure variables in function.");
+        return 0;
+    }
+
+    scope.upvalues.push_back({index, isLocal});
+    return scope.upvalues.size() - 1;
+}
+
+void Compiler::emit(OpCode op, const Token& token)
+{
+    chunk().write(op, token);
+}
+
+void Compiler::emit(OpCode op)
+{
+    chunk().write(op);
+}
+
+void Compiler::emitByte(uint8_t byte, const Token& token)
+{
+    chunk().write(byte, token);
+}
+
+void Compiler::emitShort(uint16_t value, const Token& token)
+{
+    chunk().write(value >> 8, token);
+    chunk().write(value & 0xff, token);
+}
+
+void Compiler::emitConstant(const Value& value, const Token& token)
+{
+    const int index = chunk().addConstant(value);
+    if (index > MaxOperand)
+        m_errors.error(token, "Too many constants in one chunk.");
+
+    emit(OpCode::Constant, token);
+    emitShort(index, token);
+}
+
+void Compiler::emitReturn()
+{
+    emit(OpCode::Nil);
+    emit(OpCode::Return);
+}
+
+int Compiler::emitJump(OpCode op)
+{
+    emit(op);
+    chunk().write(0xff);
+    chunk().write(0xff);
+    return chunk().code.size() - 2;
+}
+
+void Compiler::patchJump(int offset)
+{
+    const int jump = chunk().code.size() - offset - 2;
+    if (jump > MaxOperand)
+        m_errors.error(chunk().tokenAt(offset), "Too much code to jump over.");
+
+    chunk().code[offset] = (jump >> 8) & 0xff;
+    chunk().code[offset + 1] = jump & 0xff;
+}
+
+void Compiler::emitLoop(int loopStart)
+{
+    emit(OpCode::Loop);
+
+    const int offset = chunk().code.size() - loopStart + 2;
+    if (offset > MaxOperand)
+        m_errors.error(chunk().tokenAt(loopStart), "Loop body too large.");
+
+    chunk().write((offset >> 8) & 0xff);
+    chunk().write(offset & 0xff);
+}
+
+uint16_t Compiler::nameOperand(const Token& name)
+{
+    const int index = chunk().addName(LoxString::intern(name.lexeme));
+    if (index > MaxOperand)
+        m_errors.error(name, "Too many property names in one chunk.");
+    return index;
+}
+
+uint16_t Compiler::globalOperand(const Token& name)
+{
+    const int slot = m_vm.globalSlot(name.lexeme);
+    if (slot > MaxOperand)
+        m_errors.error(name, "Too many global variables.");
+    return slot;
+}
+
+uint16_t Compiler::cacheOperand(const Token& name)
+{
+    const int index = chunk().addCache();
+    if (index > MaxOperand)
+        m_errors.error(name, "Too many property accesses in one chunk.");
+    return index;
+}
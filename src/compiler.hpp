@@ -0,0 +1,114 @@
+#pragma once
+
+#include "chunk.hpp"
+#include "error.hpp"
+#include "expr.hpp"
+#include "stmt.hpp"
+#include "token.hpp"
+
+class VM;
+
+class Compiler
+{
+public:
+    // Compiles a parsed and resolved program into the top-level function of a script.
+    static std::shared_ptr<VmFunction> compile(VM& vm, NodeList<Stmt> statements, ErrorReporter& errors);
+
+private:
+    enum class FunctionType
+    {
+        Script,
+        Function,
+        Method,
+    };
+
+    struct Local
+    {
+        std::string_view name;
+        int depth;
+        bool isCaptured = false;
+    };
+
+    struct Upvalue
+    {
+        uint8_t index;
+        bool isLocal;
+    };
+
+    struct FunctionScope
+    {
+        FunctionScope* enclosing;
+        std::shared_ptr<VmFunction> function;
+        FunctionType type;
+        std::vector<Local> locals;
+        std::vector<Upvalue> upvalues;
+        int scopeDepth = 0;
+    };
+
+    Compiler(VM& vm, ErrorReporter& errors) : m_vm(vm), m_errors(errors) {}
+
+    void compileStmt(const Stmt& stmt);
+    void compileExpressionStmt(const Stmt::Expression& stmt);
+    void compilePrintStmt(const Stmt::Print& stmt);
+    void compileVarStmt(const Stmt::Var& stmt);
+    void compileBlockStmt(const Stmt::Block& stmt);
+    void compileIfStmt(const Stmt::If& stmt);
+    void compileWhileStmt(const Stmt::While& stmt);
+    void compileForStmt(const Stmt::For& stmt);
+    void compileFunStmt(const Stmt::Fun& stmt);
+    void compileReturnStmt(const Stmt::Return& stmt);
+    void compileClassStmt(const Stmt::Class& stmt);
+
+    void compileExpr(const Expr& expr);
+    void compileBinaryExpr(const Expr::Binary& expr);
+    void compileGroupingExpr(const Expr::Grouping& expr);
+    void compileLiteralExpr(const Expr::Literal& expr);
+    void compileUnaryExpr(const Expr::Unary& expr);
+    void compileVariableExpr(const Expr::Variable& expr);
+    void compileAssignExpr(const Expr::Assign& expr);
+    void compileLogicalExpr(const Expr::Logical& expr);
+    // A tail call replaces the calling frame with the callee's, see OpCode::TailCall.
+    void compileCallExpr(const Expr::Call& expr, bool tail = false);
+    void compileGetExpr(const Expr::Get& expr);
+    void compileSetExpr(const Expr::Set& expr);
+    void compileThisExpr(const Expr::This& expr);
+    void compileArrayExpr(const Expr::Array& expr);
+    void compileIndexExpr(const Expr::Index& expr);
+    void compileSetIndexExpr(const Expr::SetIndex& expr);
+
+    void compileBody(const Stmt& stmt);
+    void compileFunction(const Stmt::Fun& stmt, FunctionType type);
+    void compileArguments(const Expr::Call& expr);
+
+    void beginScope();
+    void endScope();
+
+    void declareVariable(const Token& name);
+    void defineVariable(const Token& name);
+    void getVariable(const Token& name);
+    void setVariable(const Token& name);
+
+    int resolveLocal(FunctionScope& scope, const Token& name);
+    int resolveUpvalue(FunctionScope& scope, const Token& name);
+    int addUpvalue(FunctionScope& scope, uint8_t index, bool isLocal, const Token& name);
+
+    void emit(OpCode op, const Token& token);
+    void emit(OpCode op);
+    void emitByte(uint8_t byte, const Token& token);
+    void emitShort(uint16_t value, const Token& token);
+    void emitConstant(const Value& value, const Token& token);
+    void emitReturn();
+    int emitJump(OpCode op);
+    void patchJump(int offset);
+    void emitLoop(int loopStart);
+
+    uint16_t nameOperand(const Token& name);
+    uint16_t globalOperand(const Token& name);
+    uint16_t cacheOperand(const Token& name);
+
+    Chunk& chunk() { return m_current->function->chunk; }
+
+    VM& m_vm;
+    ErrorReporter& m_errors;
+    FunctionScope* m_current = nullptr;
+};
@@ -1,49 +1,6 @@
 #include "environment.hpp"
 
-#include "error.hpp"
-
-const Value& Environment::get(const Token& name) const
-{
-    if (auto it = m_values.find(name.lexeme); it != m_values.end())
-        return it->second;
-
-    if (m_parent)
-        return m_parent->get(name);
-
-    throw RuntimeError(name, fmt::format("Undefined variable '{}'", name.lexeme));
-}
-
-void Environment::define(const std::string& name, const Value& value)
-{
-    m_values[name] = value;
-}
-
-void Environment::assign(const Token& name, const Value& value)
-{
-    if (auto it = m_values.find(name.lexeme); it != m_values.end())
-    {
-        it->second = value;
-        return;
-    }
-
-    if (m_parent)
-    {
-        m_parent->assign(name, value);
-        return;
-    }
-
-    throw RuntimeError(name, fmt::format("Undefined variable '{}'", name.lexeme));
-}
-
-const Value& Environment::getAt(int distance, const std::string& name) const
-{
-    return ancestor(distance).m_values.at(name);
-}
-
-void Environment::assignAt(int distance, const std::string& name, const Value& value)
-{
-    ancestor(distance).m_values.at(name) = value;
-}
+#include "heap.hpp"
 
 Environment& Environment::ancestor(int distance)
 {
@@ -51,18 +8,14 @@ Environment& Environment::ancestor(int distance)
 
     Environment* env = this;
     for (int i = 0; i < distance; i++)
-        env = env->m_parent.get();
+        env = env->m_parent;
 
     return *env;
 }
 
-const Environment& Environment::ancestor(int distance) const
+void Environment::trace(Heap& heap) const
 {
-    assert(distance >= 0);
-
-    const Environment* env = this;
-    for (int i = 0; i < distance; i++)
-        env = env->m_parent.get();
-
-    return *env;
+    heap.mark(m_parent);
+    for (const auto& value : m_values)
+        heap.mark(value);
 }
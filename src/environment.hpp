@@ -1,28 +1,23 @@
 #pragma once
 
-#include "token.hpp"
 #include "value.hpp"
 
-#include <unordered_map>
-
-class Environment
+// The locals of one scope, stored in the slots the resolver assigned them.
+// Globals are not in an environment, the interpreter keeps them by name.
+class Environment : public Obj
 {
 public:
-    Environment() {}
-    Environment(std::shared_ptr<Environment> parent) : m_parent(parent) {}
-
-    const Value& get(const Token& name) const;
+    Environment(Environment* parent, int size) : Obj(Type::Environment), m_parent(parent), m_values(size) {}
 
-    void define(const std::string& name, const Value& value);
-    void assign(const Token& name, const Value& value);
-
-    const Value& getAt(int distance, const std::string& name) const;
-    void assignAt(int distance, const std::string& name, const Value& value);
+    Value& at(int slot) { return m_values[slot]; }
+    Value& at(int distance, int slot) { return ancestor(distance).m_values[slot]; }
 
     Environment& ancestor(int distance);
-    const Environment& ancestor(int distance) const;
+
+    void trace(Heap& heap) const override;
+    size_t ownedBytes() const override { return m_values.size() * sizeof(Value); }
 
 private:
-    std::shared_ptr<Environment> m_parent;
-    std::unordered_map<std::string, Value> m_values;
+    Environment* m_parent;
+    std::vector<Value> m_values;
 };
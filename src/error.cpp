@@ -0,0 +1,25 @@
+#include "pch.hpp"
+
+#include "error.hpp"
+
+std::string format_as(const ScriptError& error)
+{
+    return fmt::format("[line {}] Error{}: {}", error.line, error.where, error.message);
+}
+
+ScriptError ScriptError::at(const Token& token, std::string_view message)
+{
+    if (token.type == TokenType::Eof)
+        return {token.line, " at end", std::string(message)};
+    return {token.line, fmt::format(" at '{}'", token.lexeme), std::string(message)};
+}
+
+void ErrorReporter::error(int line, std::string_view message)
+{
+    errors.push_back({line, "", std::string(message)});
+}
+
+void ErrorReporter::error(const Token& token, std::string_view message)
+{
+    errors.push_back(ScriptError::at(token, message));
+}
@@ -10,3 +10,31 @@ public:
     Token token;
     std::string message;
 };
+
+// An error in a script, found while compiling it or raised while running it.
+struct ScriptError
+{
+    // An error at the token, or at the end of the script for the end of file token.
+    static ScriptError at(const Token& token, std::string_view message);
+
+    int line;
+    // Where on the line, e.g. " at 'name'" or " at end". Empty when only the line is known.
+    std::string where;
+    std::string message;
+};
+
+// Formatted the way lox prints errors: [line 1] Error at 'name': message
+std::string format_as(const ScriptError& error);
+
+// Collects the errors found in a script instead of printing them, so whoever runs the script
+// decides what to do with them.
+class ErrorReporter
+{
+public:
+    void error(int line, std::string_view message);
+    void error(const Token& token, std::string_view message);
+
+    bool hadError() const { return !errors.empty(); }
+
+    std::vector<ScriptError> errors;
+};
@@ -1,3 +1,40 @@
 #include "pch.hpp"
 
 #include "expr.hpp"
+
+void ExprVisitor::visitExpr(const Expr& expr)
+{
+    switch (expr.kind)
+    {
+    case Expr::Kind::Binary:
+        return visitBinary(static_cast<const Expr::Binary&>(expr));
+    case Expr::Kind::Grouping:
+        return visitGrouping(static_cast<const Expr::Grouping&>(expr));
+    case Expr::Kind::Literal:
+        return visitLiteral(static_cast<const Expr::Literal&>(expr));
+    case Expr::Kind::Unary:
+        return visitUnary(static_cast<const Expr::Unary&>(expr));
+    case Expr::Kind::Variable:
+        return visitVariable(static_cast<const Expr::Variable&>(expr));
+    case Expr::Kind::Assign:
+        return visitAssign(static_cast<const Expr::Assign&>(expr));
+    case Expr::Kind::Logical:
+        return visitLogical(static_cast<const Expr::Logical&>(expr));
+    case Expr::Kind::Call:
+        return visitCall(static_cast<const Expr::Call&>(expr));
+    case Expr::Kind::Get:
+        return visitGet(static_cast<const Expr::Get&>(expr));
+    case Expr::Kind::Set:
+        return visitSet(static_cast<const Expr::Set&>(expr));
+    case Expr::Kind::This:
+        return visitThis(static_cast<const Expr::This&>(expr));
+    case Expr::Kind::Array:
+        return visitArray(static_cast<const Expr::Array&>(expr));
+    case Expr::Kind::Index:
+        return visitIndex(static_cast<const Expr::Index&>(expr));
+    case Expr::Kind::SetIndex:
+        return visitSetIndex(static_cast<const Expr::SetIndex&>(expr));
+    }
+
+    assert(0 && "unreachable");
+}
@@ -1,9 +1,24 @@
 #pragma once
 
 #include "token.hpp"
+#include "value.hpp"
 
 class ExprVisitor;
 
+// Where the resolver found a local variable: how many environments up from the current one
+// and the slot within that environment, or the slot in the frame of the running function.
+// Unresolved variables are globals, looked up by name.
+struct VarSlot
+{
+    static constexpr int Frame = -2;
+
+    int depth = -1;
+    int index = -1;
+
+    bool isGlobal() const { return depth == -1; }
+    bool isFrame() const { return depth == Frame; }
+};
+
 class Expr
 {
 public:
@@ -18,18 +33,46 @@ public:
     class Get;
     class Set;
     class This;
+    class Array;
+    class Index;
+    class SetIndex;
 
-    virtual ~Expr() = default;
-    virtual void accept(ExprVisitor& visitor) const = 0;
+    enum class Kind
+    {
+        Binary,
+        Grouping,
+        Literal,
+        Unary,
+        Variable,
+        Assign,
+        Logical,
+        Call,
+        Get,
+        Set,
+        This,
+        Array,
+        Index,
+        SetIndex,
+    };
+
+    explicit Expr(Kind kind) : kind(kind) {}
+    Expr(const Expr&) = delete;
+    Expr& operator=(const Expr&) = delete;
+
+    const Kind kind;
 };
 
+// Children of a node that come in lists, e.g. arguments and statements. Stored in the Ast's
+// arena like the nodes themselves.
+template <typename T>
+using NodeList = std::span<T* const>;
+
 class ExprVisitor
 {
 public:
-    friend class Expr;
     virtual ~ExprVisitor() = default;
 
-    void visitExpr(const Expr& expr) { expr.accept(*this); }
+    void visitExpr(const Expr& expr);
 
 protected:
     virtual void visitBinary(const Expr::Binary& expr) = 0;
@@ -39,137 +82,177 @@ protected:
     virtual void visitVariable(const Expr::Variable& expr) = 0;
     virtual void visitAssign(const Expr::Assign& expr) = 0;
     virtual void visitLogical(const Expr::Logical& expr) = 0;
+    virtual void visitCall(const Expr::Call& expr) = 0;
+    virtual void visitGet(const Expr::Get& expr) = 0;
+    virtual void visitSet(const Expr::Set& expr) = 0;
+    virtual void visitThis(const Expr::This& expr) = 0;
+    virtual void visitArray(const Expr::Array& expr) = 0;
+    virtual void visitIndex(const Expr::Index& expr) = 0;
+    virtual void visitSetIndex(const Expr::SetIndex& expr) = 0;
 };
 
 class Expr::Binary : public Expr
 {
 public:
-    Binary(std::unique_ptr<Expr> left, const Token& op, std::unique_ptr<Expr> right)
-        : left(std::move(left)), op(op), right(std::move(right))
-    {
-    }
+    Binary(Expr* left, const Token& op, Expr* right) : Expr(Kind::Binary), left(left), op(op), right(right) {}
 
-    void accept(ExprVisitor& visitor) const override { visitor.visitBinary(*this); }
-
-    std::unique_ptr<Expr> left;
-    Token op;
-    std::unique_ptr<Expr> right;
+    Expr* left;
+    const Token& op;
+    Expr* right;
 };
 
 class Expr::Grouping : public Expr
 {
 public:
-    Grouping(std::unique_ptr<Expr> expression) : expression(std::move(expression)) {}
-
-    void accept(ExprVisitor& visitor) const override { visitor.visitGrouping(*this); }
+    Grouping(Expr* expression) : Expr(Kind::Grouping), expression(expression) {}
 
-    std::unique_ptr<Expr> expression;
+    Expr* expression;
 };
 
 class Expr::Literal : public Expr
 {
 public:
-    Literal(const Token& value) : value(value) {}
+    Literal(const Token& token, const Value& value)
+        : Expr(Kind::Literal), token(token), value(value), m_object(value.isObject() ? value.getObject() : nullptr)
+    {
+    }
 
-    void accept(ExprVisitor& visitor) const override { visitor.visitLiteral(*this); }
+    const Token& token;
+    // Decoded by the parser, so evaluating a literal only returns it.
+    const Value value;
 
-    Token value;
+private:
+    Ref<Obj> m_object;
 };
 
 class Expr::Unary : public Expr
 {
 public:
-    Unary(const Token& op, std::unique_ptr<Expr> right) : op(op), right(std::move(right)) {}
-
-    void accept(ExprVisitor& visitor) const override { visitor.visitUnary(*this); }
+    Unary(const Token& op, Expr* right) : Expr(Kind::Unary), op(op), right(right) {}
 
-    Token op;
-    std::unique_ptr<Expr> right;
+    const Token& op;
+    Expr* right;
 };
 
 class Expr::Variable : public Expr
 {
 public:
-    Variable(const Token& name) : name(name) {}
+    Variable(const Token& name, LoxString* symbol) : Expr(Kind::Variable), name(name), symbol(symbol) {}
 
-    void accept(ExprVisitor& visitor) const override { visitor.visitVariable(*this); }
-
-    Token name;
+    const Token& name;
+    LoxString* symbol;
+    mutable VarSlot slot;
 };
 
 class Expr::Assign : public Expr
 {
 public:
-    Assign(const Token& name, std::unique_ptr<Expr> value) : name(name), value(std::move(value)) {}
-
-    void accept(ExprVisitor& visitor) const override { visitor.visitAssign(*this); }
+    Assign(const Token& name, LoxString* symbol, Expr* value)
+        : Expr(Kind::Assign), name(name), symbol(symbol), value(value)
+    {
+    }
 
-    Token name;
-    std::unique_ptr<Expr> value;
+    const Token& name;
+    LoxString* symbol;
+    Expr* value;
+    mutable VarSlot slot;
 };
 
 class Expr::Logical : public Expr
 {
 public:
-    Logical(std::unique_ptr<Expr> left, const Token& op, std::unique_ptr<Expr> right)
-        : left(std::move(left)), op(op), right(std::move(right))
-    {
-    }
+    Logical(Expr* left, const Token& op, Expr* right) : Expr(Kind::Logical), left(left), op(op), right(right) {}
 
-    void accept(ExprVisitor& visitor) const override { visitor.visitLogical(*this); }
-
-    std::unique_ptr<Expr> left;
-    Token op;
-    std::unique_ptr<Expr> right;
+    Expr* left;
+    const Token& op;
+    Expr* right;
 };
 
 class Expr::Call : public Expr
 {
 public:
-    Call(std::unique_ptr<Expr> callee, const Token& paren, std::vector<std::unique_ptr<Expr>>&& arguments)
-        : callee(std::move(callee)), paren(paren), arguments(std::move(arguments))
+    Call(Expr* callee, const Token& paren, NodeList<Expr> arguments)
+        : Expr(Kind::Call), callee(callee), paren(paren), arguments(arguments)
     {
     }
 
-    void accept(ExprVisitor& visitor) const override {}
-
-    std::unique_ptr<Expr> callee;
-    Token paren;
-    std::vector<std::unique_ptr<Expr>> arguments;
+    Expr* callee;
+    const Token& paren;
+    NodeList<Expr> arguments;
 };
 
 class Expr::Get : public Expr
 {
 public:
-    Get(std::unique_ptr<Expr> object, const Token& name) : object(std::move(object)), name(name) {}
-
-    void accept(ExprVisitor& visitor) const override {}
+    Get(Expr* object, const Token& name, LoxString* symbol)
+        : Expr(Kind::Get), object(object), name(name), symbol(symbol)
+    {
+    }
 
-    std::unique_ptr<Expr> object;
-    Token name;
+    Expr* object;
+    const Token& name;
+    LoxString* symbol;
+    mutable PropertyCache cache;
 };
 
 class Expr::Set : public Expr
 {
 public:
-    Set(std::unique_ptr<Expr> object, const Token& name, std::unique_ptr<Expr> value)
-        : object(std::move(object)), name(name), value(std::move(value))
+    Set(Expr* object, const Token& name, LoxString* symbol, Expr* value)
+        : Expr(Kind::Set), object(object), name(name), symbol(symbol), value(value)
     {
     }
 
-    void accept(ExprVisitor& visitor) const override {}
-
-    std::unique_ptr<Expr> object;
-    Token name;
-    std::unique_ptr<Expr> value;
+    Expr* object;
+    const Token& name;
+    LoxString* symbol;
+    Expr* value;
+    mutable PropertyCache cache;
 };
 
 class Expr::This : public Expr
 {
 public:
-    This(const Token& keyword) : keyword(keyword) {}
+    This(const Token& keyword, LoxString* symbol) : Expr(Kind::This), keyword(keyword), symbol(symbol) {}
+
+    const Token& keyword;
+    LoxString* symbol;
+    mutable VarSlot slot;
+};
+
+class Expr::Array : public Expr
+{
+public:
+    Array(const Token& bracket, NodeList<Expr> elements) : Expr(Kind::Array), bracket(bracket), elements(elements) {}
+
+    const Token& bracket;
+    NodeList<Expr> elements;
+};
+
+// Errors about the array or the index are reported at the closing bracket.
+class Expr::Index : public Expr
+{
+public:
+    Index(Expr* object, const Token& bracket, Expr* index)
+        : Expr(Kind::Index), object(object), bracket(bracket), index(index)
+    {
+    }
 
-    void accept(ExprVisitor& visitor) const override {}
+    Expr* object;
+    const Token& bracket;
+    Expr* index;
+};
+
+class Expr::SetIndex : public Expr
+{
+public:
+    SetIndex(Expr* object, const Token& bracket, Expr* index, Expr* value)
+        : Expr(Kind::SetIndex), object(object), bracket(bracket), index(index), value(value)
+    {
+    }
 
-    Token keyword;
+    Expr* object;
+    const Token& bracket;
+    Expr* index;
+    Expr* value;
 };
@@ -0,0 +1,150 @@
+#include "pch.hpp"
+
+#include "heap.hpp"
+
+#include "value.hpp"
+
+Heap::~Heap()
+{
+    // Strings and shapes go last, freeing other objects may unpin them, e.g. a closure whose
+    // function drops the names and inline caches of its bytecode.
+    const auto isLeaf = [](const Obj* object)
+    { return object->type == Obj::Type::String || object->type == Obj::Type::Shape; };
+    for (const bool leaves : {false, true})
+    {
+        Obj** link = &m_objects;
+        while (Obj* object = *link)
+        {
+            if (isLeaf(object) != leaves)
+            {
+                link = &object->m_next;
+                continue;
+            }
+            *link = object->m_next;
+            delete object;
+        }
+    }
+}
+
+void Heap::collect()
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    for (const auto* roots : m_roots)
+        roots->markRoots(*this);
+    for (const Obj* object = m_objects; object; object = object->m_next)
+    {
+        if (object->m_pins > 0)
+            mark(object);
+    }
+
+    while (!m_gray.empty())
+    {
+        const Obj* object = m_gray.back();
+        m_gray.pop_back();
+        object->trace(*this);
+    }
+
+    sweep();
+    m_nextCollection = std::max(static_cast<size_t>(m_bytes * m_growthFactor), m_threshold);
+
+    const std::chrono::duration<double> pause = std::chrono::steady_clock::now() - start;
+    m_stats.collections++;
+    m_stats.totalPause += pause;
+    m_stats.maxPause = std::max(m_stats.maxPause, pause);
+}
+
+void Heap::sweep()
+{
+    Obj** link = &m_objects;
+    while (Obj* object = *link)
+    {
+        if (object->m_marked)
+        {
+            object->m_marked = false;
+            link = &object->m_next;
+            continue;
+        }
+
+        *link = object->m_next;
+        if (object->type == Obj::Type::String)
+            m_strings.erase(static_cast<LoxString*>(object));
+        m_bytes -= object->m_size;
+        m_stats.objectsFreed++;
+        m_stats.bytesFreed += object->m_size;
+        delete object;
+    }
+}
+
+LoxString* Heap::intern(std::string_view chars)
+{
+    if (auto it = m_strings.find(chars); it != m_strings.end())
+        return *it;
+
+    return intern(std::string(chars));
+}
+
+LoxString* Heap::intern(std::string&& chars)
+{
+    if (auto it = m_strings.find(std::string_view(chars)); it != m_strings.end())
+        return *it;
+
+    const size_t hash = CharsHash()(chars);
+    auto* string = make<LoxString>(std::move(chars), hash);
+    m_strings.insert(string);
+    return string;
+}
+
+void Heap::addRoots(const GcRoots* roots)
+{
+    m_roots.push_back(roots);
+}
+
+void Heap::removeRoots(const GcRoots* roots)
+{
+    std::erase(m_roots, roots);
+}
+
+void Heap::mark(const Obj* object)
+{
+    if (!object || object->m_marked)
+        return;
+
+    object->m_marked = true;
+    m_gray.push_back(object);
+}
+
+void Heap::mark(const Value& value)
+{
+    if (value.isObject())
+        mark(value.getObject());
+}
+
+void Heap::setThreshold(size_t bytes)
+{
+    m_threshold = bytes;
+    m_nextCollection = bytes;
+}
+
+void Heap::setGrowthFactor(double factor)
+{
+    m_growthFactor = factor;
+}
+
+void Heap::printStats() const
+{
+    const size_t liveObjects = m_stats.objectsAllocated - m_stats.objectsFreed;
+    fmt::println(stderr,
+                 "[gc] {} collections, {:.3f} ms total pause, {:.3f} ms max pause",
+                 m_stats.collections,
+                 m_stats.totalPause.count() * 1000,
+                 m_stats.maxPause.count() * 1000);
+    fmt::println(stderr,
+                 "[gc] allocated {} objects ({} bytes), freed {} objects ({} bytes), {} live ({} bytes)",
+                 m_stats.objectsAllocated,
+                 m_stats.bytesAllocated,
+                 m_stats.objectsFreed,
+                 m_stats.bytesFreed,
+                 liveObjects,
+                 m_bytes);
+}
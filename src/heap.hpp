@@ -0,0 +1,152 @@
+#pragma once
+
+#include "object.hpp"
+
+#include <chrono>
+#include <unordered_set>
+
+class Value;
+
+// Implemented by the engines to mark the objects they hold outside the heap, e.g. on their stacks.
+class GcRoots
+{
+public:
+    virtual ~GcRoots() = default;
+    virtual void markRoots(Heap& heap) const = 0;
+};
+
+// Owns every Obj and frees the unreachable ones with a mark-sweep collection. Allocating never
+// collects: the engines call collectIfNeeded() at safepoints, where everything they still use is
+// reachable from their roots or pinned by a Ref.
+//
+// Every interpreter has a heap of its own and objects never move between heaps, so interpreters
+// on different threads share nothing. The heap also interns the strings allocated on it.
+class Heap
+{
+public:
+    struct Stats
+    {
+        size_t collections = 0;
+        size_t objectsAllocated = 0;
+        size_t bytesAllocated = 0;
+        size_t objectsFreed = 0;
+        size_t bytesFreed = 0;
+        std::chrono::duration<double> totalPause{};
+        std::chrono::duration<double> maxPause{};
+    };
+
+    static constexpr size_t DefaultThreshold = 1024 * 1024;
+    static constexpr double DefaultGrowthFactor = 2.0;
+
+    // Makes a heap the current one of the thread while in scope, the heap objects are created on
+    // by code that has no engine at hand, e.g. Value's string constructors. Scopes nest.
+    class Scope
+    {
+    public:
+        explicit Scope(Heap& heap) : m_previous(std::exchange(s_current, &heap)) {}
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+        ~Scope() { s_current = m_previous; }
+
+    private:
+        Heap* m_previous;
+    };
+
+    Heap() = default;
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+    // Frees every object, whether reachable or not.
+    ~Heap();
+
+    // The current heap of the thread, see Scope.
+    static Heap& get()
+    {
+        assert(s_current && "no current heap");
+        return *s_current;
+    }
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args)
+    {
+        T* object = new T(std::forward<Args>(args)...);
+        object->m_size = sizeof(T) + object->ownedBytes();
+        object->m_next = m_objects;
+        m_objects = object;
+
+        m_bytes += object->m_size;
+        m_stats.objectsAllocated++;
+        m_stats.bytesAllocated += object->m_size;
+        return object;
+    }
+
+    // Counts memory an object took on or gave back after it was created, e.g. an array growing its
+    // buffer, towards the heap like an allocation, so growth alone makes a collection due.
+    void resize(Obj& object, size_t oldBytes, size_t newBytes)
+    {
+        object.m_size = object.m_size - oldBytes + newBytes;
+        m_bytes = m_bytes - oldBytes + newBytes;
+        if (newBytes > oldBytes)
+            m_stats.bytesAllocated += newBytes - oldBytes;
+        else
+            m_stats.bytesFreed += oldBytes - newBytes;
+    }
+
+    void collectIfNeeded()
+    {
+        if (m_bytes > m_nextCollection)
+            collect();
+    }
+    void collect();
+
+    // Returns the string with these characters, creating it if it isn't interned yet.
+    LoxString* intern(std::string_view chars);
+    LoxString* intern(std::string&& chars);
+
+    void addRoots(const GcRoots* roots);
+    void removeRoots(const GcRoots* roots);
+
+    void mark(const Obj* object);
+    void mark(const Value& value);
+
+    // The first collection happens once the heap reaches `bytes`. After that the next one is
+    // due when the live heap has grown by the growth factor, but never below this threshold.
+    void setThreshold(size_t bytes);
+    void setGrowthFactor(double factor);
+
+    const Stats& stats() const { return m_stats; }
+    void printStats() const;
+
+private:
+    struct CharsHash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view chars) const { return std::hash<std::string_view>()(chars); }
+        size_t operator()(const LoxString* string) const { return string->hash; }
+    };
+
+    struct CharsEqual
+    {
+        using is_transparent = void;
+        bool operator()(const LoxString* left, const LoxString* right) const { return left == right; }
+        bool operator()(std::string_view left, const LoxString* right) const { return left == right->chars; }
+        bool operator()(const LoxString* left, std::string_view right) const { return left->chars == right; }
+    };
+
+    void sweep();
+
+    inline static thread_local Heap* s_current = nullptr;
+
+    Obj* m_objects = nullptr;
+    std::vector<const Obj*> m_gray;
+    std::vector<const GcRoots*> m_roots;
+
+    size_t m_bytes = 0;
+    size_t m_threshold = DefaultThreshold;
+    size_t m_nextCollection = DefaultThreshold;
+    double m_growthFactor = DefaultGrowthFactor;
+
+    Stats m_stats;
+
+    // Doesn't keep its strings alive, sweeping removes the strings it frees.
+    std::unordered_set<LoxString*, CharsHash, CharsEqual> m_strings;
+};
@@ -3,11 +3,10 @@
 #include "environment.hpp"
 #include "error.hpp"
 #include "interpreter.hpp"
+#include "native.hpp"
 #include "token.hpp"
 #include "value.hpp"
 
-#include <chrono>
-
 namespace
 {
 
@@ -21,37 +20,142 @@ private:
     std::function<void()> m_func;
 };
 
-class NativeFunction : public ICallable
+// Roots values held on the C++ stack for the rest of the scope. Needed while evaluating
+// anything that can run a statement, e.g. a call, as statements may collect garbage.
+class TempRoots
 {
 public:
-    std::string toString() const override { return "<native func>"; }
+    TempRoots(std::vector<Value>& roots) : m_roots(roots), m_size(roots.size()) {}
+    ~TempRoots() { m_roots.resize(m_size); }
+
+    void push(const Value& value) { m_roots.push_back(value); }
+
+private:
+    std::vector<Value>& m_roots;
+    size_t m_size;
 };
 
-class Clock : public NativeFunction
+} // namespace
+
+LoxFunction::LoxFunction(const Stmt::Fun& declaration, Environment* closure, bool isMethod)
+    : ICallable(Kind::Function), declaration(declaration), closure(closure), isMethod(isMethod)
 {
-public:
-    Value call(Interpreter& interpreter, const std::vector<Value>&) override
+}
+
+void LoxFunction::trace(Heap& heap) const
+{
+    heap.mark(closure);
+    heap.mark(receiver);
+}
+
+Value LoxFunction::call(Interpreter& interpreter, size_t base)
+{
+    auto& stack = interpreter.m_stack;
+    const size_t enclosingFrame = interpreter.m_frameBase;
+    if (interpreter.m_stats.counting)
+        interpreter.m_stats.enterCall(++interpreter.m_callDepth);
+    if (interpreter.m_profiler)
+        interpreter.m_profiler->enter(declaration);
+
+    // Tail calls replace the running function in its frame, so they loop here instead of nesting.
+    const LoxFunction* function = this;
+    Completion completion;
+    while (true)
     {
-        std::chrono::duration<double> duration = std::chrono::system_clock::now() - s_startTime;
-        return Value(duration.count());
+        const auto& declaration = function->declaration;
+        // A bound method is called with the instance it was bound to as 'this'.
+        if (function->receiver)
+            stack[base] = Value(function->receiver);
+
+        if (declaration.usesFrame)
+        {
+            // The arguments already are the first locals, the others start out nil.
+            const size_t top = base + declaration.slotCount;
+            if (top > stack.size())
+                stack.resize(std::max(top, stack.size() * 2));
+            std::fill(stack.begin() + interpreter.m_stackTop, stack.begin() + top, Value());
+            interpreter.m_stackTop = top;
+            interpreter.m_frameBase = base;
+            completion = interpreter.executeBlock(declaration.body, function->closure);
+        }
+        else
+        {
+            auto* env = interpreter.m_heap.make<Environment>(function->closure, declaration.slotCount);
+            if (interpreter.m_stats.counting)
+                interpreter.m_stats.environments++;
+            std::copy(stack.begin() + base, stack.begin() + interpreter.m_stackTop, &env->at(0));
+            completion = interpreter.executeBlock(declaration.body, env);
+        }
+        if (completion.kind != Completion::Kind::TailCall)
+            break;
+
+        // The frame of the tail call is on top of the stack and moves down over this one.
+        function = static_cast<const LoxFunction*>(completion.value.getCallable());
+        const size_t frame = interpreter.m_stackTop - 1 - function->arity();
+        std::copy(stack.begin() + frame, stack.begin() + interpreter.m_stackTop, stack.begin() + base);
+        interpreter.m_stackTop = base + 1 + function->arity();
+        if (interpreter.m_stats.counting)
+            interpreter.m_stats.enterCall(interpreter.m_callDepth);
+        if (interpreter.m_profiler)
+        {
+            interpreter.m_profiler->leave();
+            interpreter.m_profiler->enter(function->declaration);
+        }
     }
 
-    int arity() const override { return 0; }
+    interpreter.m_frameBase = enclosingFrame;
+    if (interpreter.m_profiler)
+        interpreter.m_profiler->leave();
+    if (interpreter.m_stats.counting)
+        interpreter.m_callDepth--;
+    return completion.value;
+}
 
-private:
-    inline static auto s_startTime = std::chrono::system_clock::now();
-};
+LoxFunction* LoxFunction::bind(const Value& instance) const
+{
+    auto* method = Heap::get().make<LoxFunction>(declaration, closure, true);
+    method->receiver = instance.getInstance();
+    return method;
+}
 
-} // namespace
+Interpreter::Interpreter(Heap& heap, Stats& stats) : m_heap(heap), m_stats(stats), m_stack(1024)
+{
+    defineGlobal("clock", Value(m_heap.make<Clock>()));
+    defineArrayNatives(m_heap, [this](std::string_view name, const Value& value) { defineGlobal(name, value); });
+    m_heap.addRoots(this);
+}
+
+Interpreter::~Interpreter()
+{
+    m_heap.removeRoots(this);
+}
 
-Interpreter::Interpreter()
+void Interpreter::markRoots(Heap& heap) const
 {
-    m_global->define("clock", Value(std::make_shared<Clock>()));
+    for (const auto& [name, value] : m_globals)
+    {
+        heap.mark(name);
+        heap.mark(value);
+    }
+
+    heap.mark(m_environment);
+    for (const auto* env : m_enclosing)
+        heap.mark(env);
+    for (const auto& value : m_temporaries)
+        heap.mark(value);
+    for (size_t i = 0; i < m_stackTop; i++)
+        heap.mark(m_stack[i]);
 }
 
 void Interpreter::interpret(const Stmt& stmt)
 {
-    exec(stmt);
+    // Top-level statements run outside any call, also after a runtime error unwound through some.
+    m_callDepth = 0;
+    m_stackTop = 0;
+    m_frameBase = 0;
+    if (m_profiler)
+        m_profiler->unwind();
+    m_nativeStack->run([&] { exec(stmt); });
 }
 
 Value Interpreter::interpret(const Expr& expr)
@@ -59,148 +163,239 @@ Value Interpreter::interpret(const Expr& expr)
     return eval(expr);
 }
 
-void Interpreter::exec(const Stmt& stmt)
-{
-    if (const auto* printStmt = dynamic_cast<const Stmt::Print*>(&stmt))
-        return exec(*printStmt);
-    if (const auto* exprStmt = dynamic_cast<const Stmt::Expression*>(&stmt))
-        return exec(*exprStmt);
-    if (const auto* varStmt = dynamic_cast<const Stmt::Var*>(&stmt))
-        return exec(*varStmt);
-    if (const auto* blockStmt = dynamic_cast<const Stmt::Block*>(&stmt))
-        return exec(*blockStmt);
-    if (const auto* ifStmt = dynamic_cast<const Stmt::If*>(&stmt))
-        return exec(*ifStmt);
-    if (const auto* whileStmt = dynamic_cast<const Stmt::While*>(&stmt))
-        return exec(*whileStmt);
-    if (const auto* forStmt = dynamic_cast<const Stmt::For*>(&stmt))
-        return exec(*forStmt);
-    if (const auto* funStmt = dynamic_cast<const Stmt::Fun*>(&stmt))
-        return exec(*funStmt);
-    if (const auto* returnStmt = dynamic_cast<const Stmt::Return*>(&stmt))
-        return exec(*returnStmt);
-    if (const auto* classStmt = dynamic_cast<const Stmt::Class*>(&stmt))
-        return exec(*classStmt);
+Value Interpreter::call(const Value& callee, std::span<const Value> arguments)
+{
+    m_callDepth = 0;
+    m_stackTop = 0;
+    m_frameBase = 0;
+    if (m_profiler)
+        m_profiler->unwind();
+
+    // On the stack, the host's copies of the values don't keep them alive while the call collects garbage.
+    push(callee);
+    for (const auto& argument : arguments)
+        push(argument);
+    Value result;
+    m_nativeStack->run([&] { result = call(*callee.getCallable(), 0); });
+    return result;
+}
+
+std::optional<Value> Interpreter::global(std::string_view name) const
+{
+    if (auto it = m_globals.find(LoxString::intern(name)); it != m_globals.end())
+        return it->second;
+    return std::nullopt;
+}
+
+void Interpreter::defineGlobal(std::string_view name, const Value& value)
+{
+    m_globals[LoxString::intern(name)] = value;
+}
+
+Completion Interpreter::exec(const Stmt& stmt)
+{
+    // Statements are the interpreter's safepoints, see TempRoots for what is live in between.
+    m_heap.collectIfNeeded();
+    if (m_profiler)
+        m_profiler->statement(stmt);
+
+    switch (stmt.kind)
+    {
+    case Stmt::Kind::Expression:
+        return exec(static_cast<const Stmt::Expression&>(stmt));
+    case Stmt::Kind::Print:
+        return exec(static_cast<const Stmt::Print&>(stmt));
+    case Stmt::Kind::Var:
+        return exec(static_cast<const Stmt::Var&>(stmt));
+    case Stmt::Kind::Block:
+        return exec(static_cast<const Stmt::Block&>(stmt));
+    case Stmt::Kind::If:
+        return exec(static_cast<const Stmt::If&>(stmt));
+    case Stmt::Kind::While:
+        return exec(static_cast<const Stmt::While&>(stmt));
+    case Stmt::Kind::For:
+        return exec(static_cast<const Stmt::For&>(stmt));
+    case Stmt::Kind::Fun:
+        return exec(static_cast<const Stmt::Fun&>(stmt));
+    case Stmt::Kind::Return:
+        return exec(static_cast<const Stmt::Return&>(stmt));
+    case Stmt::Kind::Class:
+        return exec(static_cast<const Stmt::Class&>(stmt));
+    }
 
     assert(0 && "unreachable");
+    return {};
 }
 
-void Interpreter::exec(const Stmt::Print& stmt)
+Completion Interpreter::exec(const Stmt::Print& stmt)
 {
     const Value value = eval(*stmt.expression);
-    fmt::println("{}", value);
+    fmt::println(m_output, "{}", value);
+    return {};
 }
 
-void Interpreter::exec(const Stmt::Expression& stmt)
+Completion Interpreter::exec(const Stmt::Expression& stmt)
 {
     eval(*stmt.expression);
+    return {};
 }
 
-void Interpreter::exec(const Stmt::Var& stmt)
+Completion Interpreter::exec(const Stmt::Var& stmt)
 {
     Value value;
     if (stmt.expression)
         value = eval(*stmt.expression);
-    m_environment->define(stmt.name.lexeme, value);
+    if (stmt.slot.isFrame())
+        m_stack[m_frameBase + stmt.slot.index] = value;
+    else
+        defineVariable(stmt.name, stmt.symbol, stmt.slot.index, value);
+    return {};
 }
 
-void Interpreter::exec(const Stmt::Block& stmt)
+Completion Interpreter::exec(const Stmt::Block& stmt)
 {
-    executeBlock(stmt.statements, std::make_shared<Environment>(m_environment));
+    // The locals of a block in a frame are in the frame already.
+    if (stmt.usesFrame)
+    {
+        for (const auto& statement : stmt.statements)
+        {
+            if (auto completion = exec(*statement); completion.kind != Completion::Kind::Normal)
+                return completion;
+        }
+        return {};
+    }
+
+    if (m_stats.counting)
+        m_stats.environments++;
+    return executeBlock(stmt.statements, m_heap.make<Environment>(m_environment, stmt.slotCount));
 }
 
-void Interpreter::exec(const Stmt::If& stmt)
+Completion Interpreter::exec(const Stmt::If& stmt)
 {
     auto condition = eval(*stmt.condition);
     if (isTruthy(condition))
-        exec(*stmt.ifBranch);
+        return exec(*stmt.ifBranch);
     else if (stmt.elseBranch)
-        exec(*stmt.elseBranch);
+        return exec(*stmt.elseBranch);
+    return {};
 }
 
-void Interpreter::exec(const Stmt::While& stmt)
+Completion Interpreter::exec(const Stmt::While& stmt)
 {
     while (isTruthy(eval(*stmt.condition)))
-        exec(*stmt.body);
+    {
+        if (auto completion = exec(*stmt.body); completion.kind != Completion::Kind::Normal)
+            return completion;
+    }
+    return {};
 }
 
-void Interpreter::exec(const Stmt::For& stmt)
+Completion Interpreter::exec(const Stmt::For& stmt)
 {
     if (stmt.initializer)
         exec(*stmt.initializer);
 
-    while (isTruthy(eval(*stmt.condition)))
+    while (!stmt.condition || isTruthy(eval(*stmt.condition)))
     {
-        exec(*stmt.body);
-        eval(*stmt.step);
+        if (auto completion = exec(*stmt.body); completion.kind != Completion::Kind::Normal)
+            return completion;
+        if (stmt.step)
+            eval(*stmt.step);
     }
+    return {};
 }
 
-void Interpreter::exec(const Stmt::Fun& stmt)
+Completion Interpreter::exec(const Stmt::Fun& stmt)
 {
-    auto functionValue = Value(std::make_shared<LoxFunction>(stmt, m_environment));
-    m_environment->define(stmt.name.lexeme, functionValue);
+    auto functionValue = Value(m_heap.make<LoxFunction>(stmt, m_environment));
+    defineVariable(stmt.name, stmt.symbol, stmt.slot, functionValue);
+    return {};
 }
 
-void Interpreter::exec(const Stmt::Return& stmt)
+Completion Interpreter::exec(const Stmt::Return& stmt)
 {
+    // A Lox function called last runs in place of the returning one, see LoxFunction::call.
+    if (stmt.tailCall)
+    {
+        const size_t base = m_stackTop;
+        auto& callable = pushCall(*stmt.tailCall);
+        if (callable.kind == ICallable::Kind::Function)
+            return {Completion::Kind::TailCall, Value(&callable)};
+        return {Completion::Kind::Return, call(callable, base, *stmt.tailCall)};
+    }
+
     Value value{};
     if (stmt.value)
         value = eval(*stmt.value);
 
-    throw Return(value);
+    return {Completion::Kind::Return, value};
 }
 
-void Interpreter::exec(const Stmt::Class& stmt)
+Completion Interpreter::exec(const Stmt::Class& stmt)
 {
-    m_environment->define(stmt.name.lexeme, Value());
-
-    std::unordered_map<std::string, std::shared_ptr<LoxFunction>> methods;
+    StringMap<ICallable*> methods;
     for (const auto& funStmt : stmt.methods)
     {
-        methods[funStmt->name.lexeme] = std::make_shared<LoxFunction>(*funStmt, m_environment);
+        methods[funStmt->symbol] = m_heap.make<LoxFunction>(*funStmt, m_environment, true);
     }
 
-    auto clazz = std::make_shared<LoxClass>(stmt.name.lexeme, std::move(methods));
-    m_environment->assign(stmt.name, Value(clazz));
+    auto clazz = Value(m_heap.make<LoxClass>(stmt.name.lexeme, std::move(methods)));
+    defineVariable(stmt.name, stmt.symbol, stmt.slot, clazz);
+    return {};
 }
 
-void Interpreter::executeBlock(const std::vector<std::unique_ptr<Stmt>>& statements, std::shared_ptr<Environment> env)
+Completion Interpreter::executeBlock(NodeList<Stmt> statements, Environment* env)
 {
-    auto previous = m_environment;
-    Finally cleanup([&]() { m_environment = previous; });
+    m_enclosing.push_back(m_environment);
+    Finally cleanup(
+        [&]()
+        {
+            m_environment = m_enclosing.back();
+            m_enclosing.pop_back();
+        });
 
     m_environment = env;
     for (const auto& stmt : statements)
     {
-        exec(*stmt);
+        if (auto completion = exec(*stmt); completion.kind != Completion::Kind::Normal)
+            return completion;
     }
+    return {};
 }
 
 Value Interpreter::eval(const Expr& expr)
 {
-    if (const auto* binaryExpr = dynamic_cast<const Expr::Binary*>(&expr))
-        return eval(*binaryExpr);
-    if (const auto* groupingExpr = dynamic_cast<const Expr::Grouping*>(&expr))
-        return eval(*groupingExpr);
-    if (const auto* literalExpr = dynamic_cast<const Expr::Literal*>(&expr))
-        return eval(*literalExpr);
-    if (const auto* unaryExpr = dynamic_cast<const Expr::Unary*>(&expr))
-        return eval(*unaryExpr);
-    if (const auto* variableExpr = dynamic_cast<const Expr::Variable*>(&expr))
-        return eval(*variableExpr);
-    if (const auto* assignExpr = dynamic_cast<const Expr::Assign*>(&expr))
-        return eval(*assignExpr);
-    if (const auto* logicalExpr = dynamic_cast<const Expr::Logical*>(&expr))
-        return eval(*logicalExpr);
-    if (const auto* callExpr = dynamic_cast<const Expr::Call*>(&expr))
-        return eval(*callExpr);
-    if (const auto* getExpr = dynamic_cast<const Expr::Get*>(&expr))
-        return eval(*getExpr);
-    if (const auto* setExpr = dynamic_cast<const Expr::Set*>(&expr))
-        return eval(*setExpr);
-    if (const auto* thisExpr = dynamic_cast<const Expr::This*>(&expr))
-        return eval(*thisExpr);
+    switch (expr.kind)
+    {
+    case Expr::Kind::Binary:
+        return eval(static_cast<const Expr::Binary&>(expr));
+    case Expr::Kind::Grouping:
+        return eval(static_cast<const Expr::Grouping&>(expr));
+    case Expr::Kind::Literal:
+        return eval(static_cast<const Expr::Literal&>(expr));
+    case Expr::Kind::Unary:
+        return eval(static_cast<const Expr::Unary&>(expr));
+    case Expr::Kind::Variable:
+        return eval(static_cast<const Expr::Variable&>(expr));
+    case Expr::Kind::Assign:
+        return eval(static_cast<const Expr::Assign&>(expr));
+    case Expr::Kind::Logical:
+        return eval(static_cast<const Expr::Logical&>(expr));
+    case Expr::Kind::Call:
+        return eval(static_cast<const Expr::Call&>(expr));
+    case Expr::Kind::Get:
+        return eval(static_cast<const Expr::Get&>(expr));
+    case Expr::Kind::Set:
+        return eval(static_cast<const Expr::Set&>(expr));
+    case Expr::Kind::This:
+        return eval(static_cast<const Expr::This&>(expr));
+    case Expr::Kind::Array:
+        return eval(static_cast<const Expr::Array&>(expr));
+    case Expr::Kind::Index:
+        return eval(static_cast<const Expr::Index&>(expr));
+    case Expr::Kind::SetIndex:
+        return eval(static_cast<const Expr::SetIndex&>(expr));
+    }
 
     assert(0 && "unreachable");
     return Value();
@@ -209,6 +404,9 @@ Value Interpreter::eval(const Expr& expr)
 Value Interpreter::eval(const Expr::Binary& expr)
 {
     auto leftValue = eval(*expr.left);
+    TempRoots roots(m_temporaries);
+    if (leftValue.isObject())
+        roots.push(leftValue);
     auto rightValue = eval(*expr.right);
 
     if (expr.op.type == TokenType::Plus)
@@ -216,7 +414,11 @@ Value Interpreter::eval(const Expr::Binary& expr)
         if (leftValue.isNumber() && rightValue.isNumber())
             return Value(leftValue.getNumber() + rightValue.getNumber());
         if (leftValue.isString() && rightValue.isString())
+        {
+            if (m_stats.counting)
+                m_stats.concatenations++;
             return Value(leftValue.getString() + rightValue.getString());
+        }
 
         throw RuntimeError(expr.op, "Operands must be two numbers or two strings");
     }
@@ -284,19 +486,7 @@ Value Interpreter::eval(const Expr::Grouping& expr)
 
 Value Interpreter::eval(const Expr::Literal& expr)
 {
-    if (expr.value.type == TokenType::Nil)
-        return Value();
-    if (expr.value.type == TokenType::False)
-        return Value(false);
-    if (expr.value.type == TokenType::True)
-        return Value(true);
-    if (expr.value.type == TokenType::Number)
-        return Value(std::stod(std::string(expr.value.lexeme)));
-    if (expr.value.type == TokenType::String)
-        return Value(std::string(expr.value.lexeme.substr(1, expr.value.lexeme.size() - 2)));
-
-    assert(0 && "unreachable");
-    return Value();
+    return expr.value;
 }
 
 Value Interpreter::eval(const Expr::Unary& expr)
@@ -319,19 +509,13 @@ Value Interpreter::eval(const Expr::Unary& expr)
 
 Value Interpreter::eval(const Expr::Variable& expr)
 {
-    return lookupVariable(expr.name, expr);
+    return lookupVariable(expr.name, expr.symbol, expr.slot);
 }
 
 Value Interpreter::eval(const Expr::Assign& expr)
 {
     auto value = eval(*expr.value);
-
-    auto it = m_locals.find(&expr);
-    if (it == m_locals.end())
-        m_global->assign(expr.name, value);
-    else
-        m_environment->assignAt(it->second, expr.name.lexeme, value);
-
+    assignVariable(expr.name, expr.symbol, expr.slot, value);
     return value;
 }
 
@@ -358,22 +542,99 @@ Value Interpreter::eval(const Expr::Logical& expr)
 
 Value Interpreter::eval(const Expr::Call& expr)
 {
-    auto callee = eval(*expr.callee);
+    const size_t base = m_stackTop;
+    return call(pushCall(expr), base, expr);
+}
+
+ICallable& Interpreter::pushCall(const Expr::Call& expr)
+{
+    if (m_nativeStack->exhausted())
+        throw RuntimeError(expr.paren, "Stack overflow.");
 
-    std::vector<Value> arguments;
+    // The callee and the arguments are evaluated onto the stack, where they start its frame.
+    const size_t base = m_stackTop;
+    // obj.method(args) calls the method with obj as 'this' instead of binding it first.
+    ICallable* callable = nullptr;
+    if (expr.callee->kind == Expr::Kind::Get)
+        callable = pushReceiver(static_cast<const Expr::Get&>(*expr.callee));
+    else
+        push(eval(*expr.callee));
     for (const auto& arg : expr.arguments)
-        arguments.emplace_back(eval(*arg));
+        push(eval(*arg));
 
-    if (!callee.isCallable())
-        throw RuntimeError(expr.paren, "Value is not callable");
+    if (!callable)
+    {
+        const Value callee = m_stack[base];
+        if (!callee.isCallable())
+            throw RuntimeError(expr.paren, "Value is not callable");
+        callable = callee.getCallable();
+    }
+    checkArity(expr, callable->arity(), static_cast<int>(expr.arguments.size()));
+    return *callable;
+}
+
+ICallable* Interpreter::pushReceiver(const Expr::Get& get)
+{
+    auto object = eval(*get.object);
+    if (!object.isInstance())
+        throw RuntimeError(get.name, "Only instances have properties");
 
-    const int arity = callee.getCallable()->arity();
-    if (arity != arguments.size())
+    auto* instance = object.getInstance();
+    const auto property = instance->getProperty(get.symbol, get.cache);
+    // A field holding a function is called like any other value.
+    if (property.isField())
     {
-        throw RuntimeError(expr.paren, fmt::format("Expected {} arguments but got {}.", arity, arguments.size()));
+        push(instance->fields[property.slot]);
+        return nullptr;
     }
+    if (!property.isMethod())
+        throw RuntimeError(get.name, fmt::format("Undefined property '{}'", get.name.lexeme));
 
-    return callee.getCallable()->call(*this, arguments);
+    // The receiver takes the callee's place in the frame, as the method's 'this'.
+    push(object);
+    return property.method;
+}
+
+Value Interpreter::call(ICallable& callable, size_t base, const Expr::Call& expr)
+{
+    try
+    {
+        return call(callable, base);
+    }
+    catch (const NativeError& e)
+    {
+        // Only a native called right here gets this far, calls it makes report their own.
+        throw RuntimeError(expr.paren, e.message);
+    }
+}
+
+Value Interpreter::call(ICallable& callable, size_t base)
+{
+    Value result;
+    switch (callable.kind)
+    {
+    case ICallable::Kind::Function:
+        result = static_cast<LoxFunction&>(callable).call(*this, base);
+        break;
+    case ICallable::Kind::Class:
+        if (m_stats.counting)
+            m_stats.instances++;
+        result = Value(m_heap.make<LoxInstance>(static_cast<LoxClass*>(&callable)));
+        break;
+    case ICallable::Kind::Native:
+        result = static_cast<NativeFunction&>(callable).call({&m_stack[base + 1], m_stackTop - base - 1});
+        break;
+    default:
+        assert(0 && "unreachable");
+    }
+    m_stackTop = base;
+    return result;
+}
+
+void Interpreter::checkArity(const Expr::Call& expr, int arity, int argCount)
+{
+    if (arity != argCount)
+        throw RuntimeError(expr.paren, fmt::format("Expected {} arguments but got {}.", arity, argCount));
 }
 
 Value Interpreter::eval(const Expr::Get& expr)
@@ -381,13 +642,15 @@ Value Interpreter::eval(const Expr::Get& expr)
     auto object = eval(*expr.object);
     if (object.isInstance())
     {
-        auto instance = object.getInstance();
-        if (auto it = instance->fields.find(expr.name.lexeme); it != instance->fields.end())
-            return it->second;
-
-        if (auto it = instance->clazz.methods.find(expr.name.lexeme); it != instance->clazz.methods.end())
+        auto* instance = object.getInstance();
+        const auto property = instance->getProperty(expr.symbol, expr.cache);
+        if (property.isField())
+            return instance->fields[property.slot];
+        if (property.isMethod())
         {
-            return Value(std::make_shared<LoxFunction>(it->second->bind(object)));
+            if (m_stats.counting)
+                m_stats.methodBinds++;
+            return Value(static_cast<const LoxFunction&>(*property.method).bind(object));
         }
 
         throw RuntimeError(expr.name, fmt::format("Undefined property '{}'", expr.name.lexeme));
@@ -402,39 +665,49 @@ Value Interpreter::eval(const Expr::Set& expr)
     if (!object.isInstance())
         throw RuntimeError(expr.name, "Only instances have fields.");
 
+    TempRoots roots(m_temporaries);
+    roots.push(object);
     auto value = eval(*expr.value);
-    object.getInstance()->set(expr.name, value);
+    object.getInstance()->setField(expr.symbol, value, expr.cache);
     return value;
 }
 
 Value Interpreter::eval(const Expr::This& expr)
 {
-    return lookupVariable(expr.keyword, expr);
+    return lookupVariable(expr.keyword, expr.symbol, expr.slot);
 }
 
-bool Interpreter::isTruthy(const Value& value)
+Value Interpreter::eval(const Expr::Array& expr)
 {
-    if (value.isNil())
-        return false;
-    if (value.isBoolean())
-        return value.getBoolean();
-    return true;
+    // The elements are kept on the stack until the array holds them.
+    const size_t base = m_stackTop;
+    for (const auto* element : expr.elements)
+        push(eval(*element));
+    auto* array = m_heap.make<LoxArray>(std::span<const Value>(m_stack.data() + base, m_stackTop - base));
+    m_stackTop = base;
+    return Value(array);
 }
 
-bool Interpreter::isEqual(const Value& left, const Value& right)
+Value Interpreter::eval(const Expr::Index& expr)
 {
-    if (left.getType() != right.getType())
-        return false;
-    if (left.isNil())
-        return true;
-    if (left.isBoolean())
-        return left.getBoolean() == right.getBoolean();
-    if (left.isNumber())
-        return left.getNumber() == right.getNumber();
-    if (left.isString())
-        return left.getString() == right.getString();
+    auto object = eval(*expr.object);
+    TempRoots roots(m_temporaries);
+    roots.push(object);
+    auto index = eval(*expr.index);
+    const auto [array, element] = checkElement(expr.bracket, object, index);
+    return array->at(element);
+}
 
-    assert(0 && "unreachable");
+Value Interpreter::eval(const Expr::SetIndex& expr)
+{
+    auto object = eval(*expr.object);
+    TempRoots roots(m_temporaries);
+    roots.push(object);
+    auto index = eval(*expr.index);
+    auto value = eval(*expr.value);
+    const auto [array, element] = checkElement(expr.bracket, object, index);
+    array->set(element, value);
+    return value;
 }
 
 void Interpreter::checkNumber(const Token& token, const Value& value)
@@ -455,16 +728,58 @@ void Interpreter::checkString(const Token& token, const Value& value)
         throw RuntimeError(token, "Operand must be a string.");
 }
 
-void Interpreter::resolve(const Expr& expr, int scope)
+std::pair<LoxArray*, size_t> Interpreter::checkElement(const Token& token, const Value& object, const Value& index)
 {
-    m_locals[&expr] = scope;
+    if (!object.isArray())
+        throw RuntimeError(token, "Only arrays can be indexed.");
+    if (!index.isNumber())
+        throw RuntimeError(token, "Array index must be a number.");
+    auto* array = object.getArray();
+    const auto element = array->element(index.getNumber());
+    if (!element)
+        throw RuntimeError(token, "Array index out of range.");
+    return {array, *element};
 }
 
-Value Interpreter::lookupVariable(const Token& name, const Expr& expr)
+void Interpreter::defineVariable(const Token& name, LoxString* symbol, int slot, const Value& value)
 {
-    auto it = m_locals.find(&expr);
-    if (it == m_locals.end())
-        return m_global->get(name);
+    if (slot < 0)
+        m_globals[symbol] = value;
     else
-        return m_environment->getAt(it->second, name.lexeme);
+        m_environment->at(slot) = value;
+}
+
+Value Interpreter::lookupVariable(const Token& name, LoxString* symbol, VarSlot slot)
+{
+    if (slot.isFrame())
+        return m_stack[m_frameBase + slot.index];
+    if (!slot.isGlobal())
+        return m_environment->at(slot.depth, slot.index);
+
+    if (auto it = m_globals.find(symbol); it != m_globals.end())
+        return it->second;
+
+    throw RuntimeError(name, fmt::format("Undefined variable '{}'", name.lexeme));
+}
+
+void Interpreter::assignVariable(const Token& name, LoxString* symbol, VarSlot slot, const Value& value)
+{
+    if (slot.isFrame())
+    {
+        m_stack[m_frameBase + slot.index] = value;
+        return;
+    }
+    if (!slot.isGlobal())
+    {
+        m_environment->at(slot.depth, slot.index) = value;
+        return;
+    }
+
+    if (auto it = m_globals.find(symbol); it != m_globals.end())
+    {
+        it->second = value;
+        return;
+    }
+
+    throw RuntimeError(name, fmt::format("Undefined variable '{}'", name.lexeme));
 }
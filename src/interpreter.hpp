@@ -2,40 +2,92 @@
 
 #include "environment.hpp"
 #include "expr.hpp"
+#include "heap.hpp"
+#include "profiler.hpp"
+#include "stack.hpp"
+#include "stats.hpp"
 #include "stmt.hpp"
 #include "value.hpp"
 
-#include <unordered_map>
+#include <optional>
 
-struct Return
+class Interpreter;
+
+class LoxFunction : public ICallable
 {
-    Return(const Value& value) : value(value) {}
+public:
+    LoxFunction(const Stmt::Fun& declaration, Environment* closure, bool isMethod = false);
+
+    std::string toString() const override { return fmt::format("<fun {}>", declaration.name.lexeme); }
+    int arity() const override { return declaration.params.size(); }
+    void trace(Heap& heap) const override;
+    // Runs the function on the frame at the top of the interpreter's stack from base on: the
+    // receiver of a method or the function itself, followed by the arguments.
+    Value call(Interpreter& interpreter, size_t base);
+    // Binds a method to the instance, for when the method is used as a value instead of called.
+    LoxFunction* bind(const Value& instance) const;
 
-    Value value;
+    const Stmt::Fun& declaration;
+    Environment* closure;
+    // Methods keep 'this' in the first slot of their frame or environment, ahead of the parameters.
+    const bool isMethod;
+    // The instance a bound method was bound to.
+    LoxInstance* receiver = nullptr;
 };
 
-class Interpreter
+// How a statement finished: normally, or by a return statement that unwinds to the enclosing call.
+struct Completion
+{
+    enum class Kind
+    {
+        Normal,
+        Return,
+        // Returns what calling the function in value returns, with the frame on top of the stack.
+        TailCall,
+    };
+
+    Kind kind = Kind::Normal;
+    // The returned value.
+    Value value = Value();
+};
+
+class Interpreter : public GcRoots
 {
 public:
     friend class LoxFunction;
-    Interpreter();
+    Interpreter(Heap& heap, Stats& stats);
+    ~Interpreter();
+
+    void markRoots(Heap& heap) const override;
+
+    // Samples the Lox call stack from now on, null to stop.
+    void setProfiler(Profiler* profiler) { m_profiler = profiler; }
+    // Where print statements write to, stdout by default.
+    void setOutput(std::FILE* output) { m_output = output; }
+    // Bytes of native stack Lox code runs on, which limits how deep calls nest.
+    void setStackSize(size_t bytes) { m_nativeStack = std::make_unique<NativeStack>(bytes); }
 
     void interpret(const Stmt& stmt);
     Value interpret(const Expr& expr);
-    void resolve(const Expr& expr, int scope);
+
+    // Calls a function, class or native from outside any Lox code, checked for arity by the caller.
+    Value call(const Value& callee, std::span<const Value> arguments);
+    // The value of a global variable, empty if it isn't defined.
+    std::optional<Value> global(std::string_view name) const;
+    void defineGlobal(std::string_view name, const Value& value);
 
 private:
-    void exec(const Stmt& stmt);
-    void exec(const Stmt::Print& stmt);
-    void exec(const Stmt::Expression& stmt);
-    void exec(const Stmt::Var& stmt);
-    void exec(const Stmt::Block& stmt);
-    void exec(const Stmt::If& stmt);
-    void exec(const Stmt::While& stmt);
-    void exec(const Stmt::For& stmt);
-    void exec(const Stmt::Fun& stmt);
-    void exec(const Stmt::Return& stmt);
-    void exec(const Stmt::Class& stmt);
+    Completion exec(const Stmt& stmt);
+    Completion exec(const Stmt::Print& stmt);
+    Completion exec(const Stmt::Expression& stmt);
+    Completion exec(const Stmt::Var& stmt);
+    Completion exec(const Stmt::Block& stmt);
+    Completion exec(const Stmt::If& stmt);
+    Completion exec(const Stmt::While& stmt);
+    Completion exec(const Stmt::For& stmt);
+    Completion exec(const Stmt::Fun& stmt);
+    Completion exec(const Stmt::Return& stmt);
+    Completion exec(const Stmt::Class& stmt);
 
     Value eval(const Expr& expr);
     Value eval(const Expr::Binary& expr);
@@ -49,18 +101,60 @@ private:
     Value eval(const Expr::Get& expr);
     Value eval(const Expr::Set& expr);
     Value eval(const Expr::This& expr);
+    Value eval(const Expr::Array& expr);
+    Value eval(const Expr::Index& expr);
+    Value eval(const Expr::SetIndex& expr);
+
+    // Evaluates the callee, or the receiver of a method, and the arguments onto the stack and
+    // checks that they can be called. Returns what to call.
+    ICallable& pushCall(const Expr::Call& expr);
+    // Pushes the receiver of obj.method(...) and returns the method, or pushes the value of the
+    // field it calls instead and returns null.
+    ICallable* pushReceiver(const Expr::Get& get);
+    Value call(ICallable& callable, size_t base, const Expr::Call& expr);
+    // Calls with the callee's frame on the stack from base on, and pops it.
+    Value call(ICallable& callable, size_t base);
+    void push(Value value)
+    {
+        if (m_stackTop == m_stack.size())
+            m_stack.resize(m_stack.size() * 2);
+        m_stack[m_stackTop++] = value;
+    }
 
-    void executeBlock(const std::vector<std::unique_ptr<Stmt>>& statements, std::shared_ptr<Environment> env);
+    Completion executeBlock(NodeList<Stmt> statements, Environment* env);
 
-    bool isTruthy(const Value& value);
-    bool isEqual(const Value& left, const Value& right);
     void checkNumber(const Token& token, const Value& value);
     void checkNumber(const Token& token, const Value& left, const Value& right);
     void checkString(const Token& token, const Value& value);
+    // The array and the element of it an index refers to.
+    std::pair<LoxArray*, size_t> checkElement(const Token& token, const Value& object, const Value& index);
+    void checkArity(const Expr::Call& expr, int arity, int argCount);
 
-    Value lookupVariable(const Token& name, const Expr& expr);
+    void defineVariable(const Token& name, LoxString* symbol, int slot, const Value& value);
+    Value lookupVariable(const Token& name, LoxString* symbol, VarSlot slot);
+    void assignVariable(const Token& name, LoxString* symbol, VarSlot slot, const Value& value);
 
-    std::shared_ptr<Environment> m_global = std::make_shared<Environment>();
-    std::shared_ptr<Environment> m_environment = m_global;
-    std::unordered_map<const Expr*, int> m_locals;
+    Heap& m_heap;
+    Stats& m_stats;
+    std::FILE* m_output = stdout;
+    StringMap<Value> m_globals;
+    // Null while executing top-level code.
+    Environment* m_environment = nullptr;
+    // The environments of the blocks and calls m_environment is nested in.
+    std::vector<Environment*> m_enclosing;
+    // The frames of the running calls: the callee and arguments of each, followed by the locals of
+    // functions that keep them in a frame instead of an environment. Grows by doubling and is
+    // addressed by index, so calls reuse its slots and allocate nothing.
+    std::vector<Value> m_stack;
+    size_t m_stackTop = 0;
+    // Where the frame of the innermost running function starts.
+    size_t m_frameBase = 0;
+    // Every Lox call nests a few C++ calls, made on this stack instead of the thread's, so a
+    // recursion too deep for it ends in a runtime error instead of a crash.
+    std::unique_ptr<NativeStack> m_nativeStack = std::make_unique<NativeStack>(DefaultStackSize);
+    // Lox calls currently running.
+    int m_callDepth = 0;
+    Profiler* m_profiler = nullptr;
+    // Values only held on the C++ stack across code that may collect garbage.
+    std::vector<Value> m_temporaries;
 };
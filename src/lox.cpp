@@ -2,91 +2,199 @@
 
 #include "lox.hpp"
 
-#include "error.hpp"
+#include "ast.hpp"
+#include "cache.hpp"
+#include "compiler.hpp"
 #include "interpreter.hpp"
 #include "parser.hpp"
-#include "printer.hpp"
 #include "resolver.hpp"
-#include "scanner.hpp"
+#include "stats.hpp"
+#include "vm.hpp"
 
-#include <fstream>
-#include <sstream>
+Lox::Lox(Engine engine) : m_engine(engine)
+{
+    Heap::Scope scope(m_heap);
+    if (engine == Engine::VM)
+        m_vm = std::make_unique<VM>(m_heap, m_stats);
+    else
+        m_interpreter = std::make_unique<Interpreter>(m_heap, m_stats);
+}
 
-Interpreter interpreter;
+Lox::~Lox() = default;
 
-bool hadError = false;
+std::vector<ScriptError> Lox::run(Source source)
+{
+    Heap::Scope scope(m_heap);
+    ErrorReporter errors;
+    if (m_cache && m_engine == Engine::VM)
+    {
+        // The tokens of bytecode loaded from the cache view into the source, which has to stay put.
+        auto cached = std::make_unique<Source>(std::move(source));
+        if (runCached(*cached, errors))
+            m_cachedSources.push_back(std::move(cached));
+        else
+            compileAndRun(std::move(*cached), errors);
+    }
+    else
+    {
+        compileAndRun(std::move(source), errors);
+    }
+    return std::move(errors.errors);
+}
 
-static void run(std::string_view code)
+void Lox::compileAndRun(Source source, ErrorReporter& errors)
 {
-    auto tokens = Scanner::scanTokens(code);
-    auto statements = Parser::parse(tokens);
-    Resolver::resolve(interpreter, statements);
-    if (hadError)
+    Ast* program;
+    {
+        PhaseTimer timer(m_stats.scan);
+        program = m_programs.emplace_back(std::make_unique<Ast>(std::move(source), errors)).get();
+    }
+    {
+        PhaseTimer timer(m_stats.parse);
+        Parser::parse(*program, errors);
+    }
+    const auto& ast = *program;
+    m_stats.tokens += ast.tokens.size();
+    m_stats.nodes += ast.nodeCount();
+    {
+        PhaseTimer timer(m_stats.resolve);
+        Resolver::resolve(ast.statements, errors);
+    }
+    if (errors.hadError())
         return;
 
     try
     {
-        for (const auto& stmt : statements)
+        if (m_engine == Engine::VM)
         {
-            interpreter.interpret(*stmt);
+            std::shared_ptr<VmFunction> script;
+            {
+                PhaseTimer timer(m_stats.compile);
+                script = Compiler::compile(*m_vm, ast.statements, errors);
+            }
+            if (errors.hadError())
+                return;
+            if (m_cache)
+                m_cache->store(ast.source, *script, *m_vm);
+
+            PhaseTimer timer(m_stats.execute);
+            m_vm->interpret(std::move(script));
+        }
+        else
+        {
+            PhaseTimer timer(m_stats.execute);
+            for (const auto* stmt : ast.statements)
+            {
+                m_interpreter->interpret(*stmt);
+            }
         }
     }
     catch (const RuntimeError& e)
     {
-        error(e.token, e.message);
+        errors.error(e.token, e.message);
     }
 }
 
-void runFile(const char* filename)
+bool Lox::runCached(Source& source, ErrorReporter& errors)
 {
-    std::ifstream file(filename);
-    if (!file)
+    std::shared_ptr<VmFunction> script;
     {
-        fmt::println(stderr, "Error opening file: {}", filename);
-        std::exit(1);
+        PhaseTimer timer(m_stats.cacheLoad);
+        script = m_cache->load(source, *m_vm);
     }
+    if (!script)
+        return false;
 
-    std::stringstream ss;
-    ss << file.rdbuf();
+    try
+    {
+        PhaseTimer timer(m_stats.execute);
+        m_vm->interpret(std::move(script));
+    }
+    catch (const RuntimeError& e)
+    {
+        errors.error(e.token, e.message);
+    }
+    return true;
+}
 
-    run(ss.str());
+Value Lox::string(std::string_view chars)
+{
+    return Value(m_heap.intern(chars));
+}
 
-    if (hadError)
-        std::exit(1);
+std::optional<Value> Lox::global(std::string_view name)
+{
+    // Looking a name up interns it.
+    Heap::Scope scope(m_heap);
+    return m_engine == Engine::VM ? m_vm->global(name) : m_interpreter->global(name);
+}
+
+void Lox::defineGlobal(std::string_view name, const Value& value)
+{
+    Heap::Scope scope(m_heap);
+    if (m_engine == Engine::VM)
+        m_vm->defineGlobal(name, value);
+    else
+        m_interpreter->defineGlobal(name, value);
 }
 
-void runPrompt()
+CallResult Lox::call(const Value& callee, std::span<const Value> arguments)
 {
-    std::string line;
-    while (true)
+    // There is no call site to report these at, so they have no line.
+    if (!callee.isCallable())
+        return {Value(), ScriptError{0, "", "Value is not callable"}};
+    const int arity = callee.getCallable()->arity();
+    if (arity != arguments.size())
+        return {Value(), ScriptError{0, "", fmt::format("Expected {} arguments but got {}.", arity, arguments.size())}};
+
+    Heap::Scope scope(m_heap);
+    try
+    {
+        if (m_engine == Engine::VM)
+            return {m_vm->call(callee, arguments), std::nullopt};
+        return {m_interpreter->call(callee, arguments), std::nullopt};
+    }
+    catch (const RuntimeError& e)
     {
-        std::cerr << "> " << std::flush;
-        if (!std::getline(std::cin, line))
-            break;
-        run(line);
-        hadError = false;
+        return {Value(), ScriptError::at(e.token, e.message)};
+    }
+    catch (const NativeError& e)
+    {
+        return {Value(), ScriptError{0, "", e.message}};
     }
 }
 
-static void reportError(int line, std::string_view where, std::string_view message)
+CallResult Lox::call(std::string_view name, std::span<const Value> arguments)
 {
-    fmt::println(stderr, "[line {}] Error{}: {}", line, where, message);
-    hadError = true;
+    const auto callee = global(name);
+    if (!callee)
+        return {Value(), ScriptError{0, "", fmt::format("Undefined variable '{}'", name)}};
+    return call(*callee, arguments);
 }
 
-void error(int line, std::string_view message)
+void Lox::setCache(std::filesystem::path directory)
 {
-    reportError(line, "", message);
+    m_cache = std::make_unique<ProgramCache>(std::move(directory));
 }
 
-void error(const Token& token, std::string_view message)
+void Lox::setProfiler(Profiler* profiler)
 {
-    if (token.type == TokenType::Eof)
-    {
-        reportError(token.line, " at end", message);
-    }
+    if (m_interpreter)
+        m_interpreter->setProfiler(profiler);
+}
+
+void Lox::setOutput(std::FILE* output)
+{
+    if (m_vm)
+        m_vm->setOutput(output);
     else
-    {
-        reportError(token.line, fmt::format(" at '{}'", token.lexeme), message);
-    }
+        m_interpreter->setOutput(output);
+}
+
+void Lox::setStackSize(size_t bytes)
+{
+    if (m_vm)
+        m_vm->setStackSize(bytes);
+    else
+        m_interpreter->setStackSize(bytes);
 }
@@ -1,9 +1,109 @@
 #pragma once
 
-#include "token.hpp"
+#include "error.hpp"
+#include "heap.hpp"
+#include "native.hpp"
+#include "source.hpp"
+#include "stats.hpp"
+#include "value.hpp"
 
-void runFile(const char* filename);
-void runPrompt();
+#include <filesystem>
+#include <optional>
 
-void error(int line, std::string_view message);
-void error(const Token& token, std::string_view message);
+class Ast;
+class Interpreter;
+class ProgramCache;
+class Profiler;
+class VM;
+
+enum class Engine
+{
+    Interpreter,
+    VM,
+};
+
+// What calling a Lox function from C++ returned, or the runtime error it stopped with.
+struct CallResult
+{
+    Value value;
+    std::optional<ScriptError> error;
+
+    explicit operator bool() const { return !error; }
+};
+
+// A Lox interpreter for hosts to embed. Scripts are compiled once and their globals stay defined,
+// so the host can look functions up by name and call them as often as it likes.
+//
+// Values that are objects, e.g. strings and functions, live on the garbage collected heap. The
+// host's copies don't keep them alive, so they are only valid until the next run or call.
+//
+// Every Lox is an isolate with a heap, strings, globals and stats of its own. Different ones can
+// run on different threads at the same time; one Lox is only ever used by one thread at a time,
+// and its values are only passed back to it.
+class Lox
+{
+public:
+    explicit Lox(Engine engine);
+    Lox(const Lox&) = delete;
+    Lox& operator=(const Lox&) = delete;
+    ~Lox();
+
+    Engine engine() const { return m_engine; }
+    Heap& heap() { return m_heap; }
+    const Stats& stats() const { return m_stats; }
+    // Has the engine count calls, allocations and the like for stats(), which it doesn't by
+    // default. Only the phase times are kept without it.
+    void setCounting(bool counting) { m_stats.counting = counting; }
+
+    // Compiles and runs a script. Returns the errors it didn't compile with, or the runtime error it
+    // stopped with; none if it ran to the end.
+    std::vector<ScriptError> run(Source source);
+    std::vector<ScriptError> run(std::string_view source) { return run(Source(std::string(source))); }
+
+    // A string to pass to a call, created on the heap of this Lox.
+    Value string(std::string_view chars);
+
+    // The value of a global variable, empty if no script has defined it.
+    std::optional<Value> global(std::string_view name);
+    void defineGlobal(std::string_view name, const Value& value);
+
+    // Makes a C++ function callable from scripts as a global, e.g. defineNative<&sqrt>("sqrt").
+    // Its arity and the checks and conversions of its arguments and result follow from its
+    // signature, see NativeType for the types it can take and return.
+    template <auto Function>
+    void defineNative(std::string_view name)
+    {
+        defineGlobal(name, Value(m_heap.make<BoundNative<Function>>()));
+    }
+
+    CallResult call(const Value& callee, std::span<const Value> arguments);
+    // Calls the global of that name.
+    CallResult call(std::string_view name, std::span<const Value> arguments);
+
+    // Keeps the bytecode of scripts in the directory, to run them without compiling next time.
+    // Only used by the VM, the tree-walking interpreter has nothing to cache.
+    void setCache(std::filesystem::path directory);
+    // Samples the call stack of the tree-walking interpreter, null to stop. Not supported by the VM.
+    void setProfiler(Profiler* profiler);
+    // Where print statements write to, stdout by default.
+    void setOutput(std::FILE* output);
+    // Memory for the call stack, 256 MiB by default. Calls nested deeper than it holds fail with
+    // a "Stack overflow." runtime error.
+    void setStackSize(size_t bytes);
+
+private:
+    void compileAndRun(Source source, ErrorReporter& errors);
+    // Runs a script on the VM from the cache, false if it has no usable entry for the source.
+    bool runCached(Source& source, ErrorReporter& errors);
+
+    const Engine m_engine;
+    // Outlives everything below, which may still pin objects on it.
+    Heap m_heap;
+    Stats m_stats;
+    // Functions refer to the syntax tree or source they were declared in, so every script run is kept.
+    std::vector<std::unique_ptr<Ast>> m_programs;
+    std::vector<std::unique_ptr<Source>> m_cachedSources;
+    std::unique_ptr<Interpreter> m_interpreter;
+    std::unique_ptr<VM> m_vm;
+    std::unique_ptr<ProgramCache> m_cache;
+};
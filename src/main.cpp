@@ -1,20 +1,165 @@
 #include "pch.hpp"
 
+#include "cache.hpp"
+#include "heap.hpp"
 #include "lox.hpp"
+#include "profiler.hpp"
+#include "stats.hpp"
+
+#include <charconv>
+#include <optional>
+
+[[noreturn]] static void usage()
+{
+    fmt::println(stderr,
+                 "Usage: lox [--engine=tree|vm] [--stats] [--profile[=file]] [--profile-interval=us] [--cache[=dir]] "
+                 "[--gc-stats] [--gc-threshold=bytes] [--gc-growth=factor] [--stack-size=bytes] [script]");
+    std::exit(1);
+}
+
+// Parses the value of a --name=value option.
+template <typename T>
+static T optionValue(std::string_view arg)
+{
+    const auto text = arg.substr(arg.find('=') + 1);
+    T value{};
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (ec != std::errc() || end != text.data() + text.size() || value < 0)
+        usage();
+    return value;
+}
+
+// Prints the errors, true if there were any.
+static bool report(const std::vector<ScriptError>& errors)
+{
+    for (const auto& error : errors)
+        fmt::println(stderr, "{}", error);
+    return !errors.empty();
+}
+
+static int runFile(Lox& lox, const char* filename)
+{
+    auto source = Source::load(filename);
+    if (!source)
+    {
+        fmt::println(stderr, "Error opening file: {}", filename);
+        return 1;
+    }
+    return report(lox.run(std::move(*source))) ? 1 : 0;
+}
+
+static void runPrompt(Lox& lox)
+{
+    std::string line;
+    while (true)
+    {
+        std::cerr << "> " << std::flush;
+        if (!std::getline(std::cin, line))
+            break;
+        report(lox.run(Source(line)));
+    }
+}
 
 int main(int argc, char** argv)
 {
-    if (argc > 2)
+    Engine engine = Engine::Interpreter;
+    const char* script = nullptr;
+    const char* profile = nullptr;
+    std::optional<std::filesystem::path> cache;
+    int profileInterval = 1000;
+    bool stats = false;
+    bool gcStats = false;
+    std::optional<size_t> gcThreshold;
+    std::optional<double> gcGrowth;
+    std::optional<size_t> stackSize;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+        if (arg == "--engine=tree")
+            engine = Engine::Interpreter;
+        else if (arg == "--engine=vm")
+            engine = Engine::VM;
+        else if (arg == "--stats")
+            stats = true;
+        else if (arg == "--profile")
+            profile = "profile.folded";
+        else if (arg.starts_with("--profile="))
+            profile = argv[i] + arg.find('=') + 1;
+        else if (arg.starts_with("--profile-interval="))
+            profileInterval = std::max(optionValue<int>(arg), 1);
+        else if (arg == "--cache")
+            cache = ProgramCache::defaultDirectory();
+        else if (arg.starts_with("--cache="))
+            cache = arg.substr(arg.find('=') + 1);
+        else if (arg == "--gc-stats")
+            gcStats = true;
+        else if (arg.starts_with("--gc-threshold="))
+            gcThreshold = optionValue<size_t>(arg);
+        else if (arg.starts_with("--gc-growth="))
+            gcGrowth = optionValue<double>(arg);
+        else if (arg.starts_with("--stack-size="))
+            stackSize = optionValue<size_t>(arg);
+        else if (!arg.starts_with("--") && !script)
+            script = argv[i];
+        else
+            usage();
+    }
+
+    Lox lox(engine);
+    if (gcThreshold)
+        lox.heap().setThreshold(*gcThreshold);
+    if (gcGrowth)
+        lox.heap().setGrowthFactor(*gcGrowth);
+    if (stackSize)
+        lox.setStackSize(*stackSize);
+    lox.setCounting(stats);
+
+    std::unique_ptr<Profiler> profiler;
+    if (profile)
+    {
+        // The VM has no shadow stack to sample.
+        if (engine != Engine::Interpreter)
+        {
+            fmt::println(stderr, "--profile is only supported by the tree-walking interpreter.");
+            return 1;
+        }
+        profiler = std::make_unique<Profiler>(std::chrono::microseconds(profileInterval));
+        lox.setProfiler(profiler.get());
+    }
+
+    if (cache)
     {
-        fmt::println(stderr, "Usage: lox [script]");
-        std::exit(1);
+        // The tree-walking interpreter runs the syntax tree, which has no cached form.
+        if (engine != Engine::VM)
+        {
+            fmt::println(stderr, "--cache is only supported by the VM.");
+            return 1;
+        }
+        lox.setCache(std::move(*cache));
     }
-    else if (argc == 2)
+
+    int status = 0;
+    if (script)
     {
-        runFile(argv[1]);
+        status = runFile(lox, script);
     }
     else
     {
-        runPrompt();
+        runPrompt(lox);
+    }
+
+    if (profiler)
+    {
+        // Reported while the syntax trees the samples refer to are still alive.
+        profiler->stop();
+        profiler->printReport();
+        if (!profiler->writeFolded(profile))
+            fmt::println(stderr, "Error writing profile: {}", profile);
     }
+    if (stats)
+        lox.stats().print();
+    if (gcStats)
+        lox.heap().printStats();
+    return status;
 }
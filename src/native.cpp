@@ -0,0 +1,62 @@
+#include "pch.hpp"
+
+#include "heap.hpp"
+#include "native.hpp"
+
+static void checkNumeric(LoxArray& array)
+{
+    if (!array.makeNumeric())
+        throw NativeError{"Array must only hold numbers."};
+}
+
+static double length(LoxArray& array)
+{
+    return static_cast<double>(array.size());
+}
+
+static void push(LoxArray& array, const Value& value)
+{
+    array.push(value);
+}
+
+static double sum(LoxArray& array)
+{
+    checkNumeric(array);
+    return array.sum();
+}
+
+static double dot(LoxArray& left, LoxArray& right)
+{
+    checkNumeric(left);
+    checkNumeric(right);
+    if (left.size() != right.size())
+        throw NativeError{"Arrays must have the same length."};
+    return left.dot(right);
+}
+
+static void scale(LoxArray& array, double factor)
+{
+    checkNumeric(array);
+    array.scale(factor);
+}
+
+static void fill(LoxArray& array, const Value& value)
+{
+    array.fill(value);
+}
+
+template <auto Function>
+static Value native(Heap& heap)
+{
+    return Value(heap.make<BoundNative<Function>>());
+}
+
+void defineArrayNatives(Heap& heap, const std::function<void(std::string_view, const Value&)>& defineGlobal)
+{
+    defineGlobal("length", native<&length>(heap));
+    defineGlobal("push", native<&push>(heap));
+    defineGlobal("sum", native<&sum>(heap));
+    defineGlobal("dot", native<&dot>(heap));
+    defineGlobal("scale", native<&scale>(heap));
+    defineGlobal("fill", native<&fill>(heap));
+}
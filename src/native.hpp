@@ -0,0 +1,162 @@
+#pragma once
+
+#include "value.hpp"
+
+#include <chrono>
+#include <concepts>
+#include <limits>
+
+// Native functions shared by the interpreter and the VM.
+
+// Thrown by a native for arguments it can't take. The engine reports it as a runtime error at the call.
+struct NativeError
+{
+    std::string message;
+};
+
+// How a C++ parameter or return type converts to and from a Value. Types without a
+// specialization don't compile as parameters or results of a bound native.
+template <typename T>
+struct NativeType;
+
+template <>
+struct NativeType<Value>
+{
+    static constexpr std::string_view name = "a value";
+    static bool is(const Value&) { return true; }
+    static const Value& get(const Value& value) { return value; }
+    static Value make(const Value& value) { return value; }
+};
+
+template <>
+struct NativeType<bool>
+{
+    static constexpr std::string_view name = "a boolean";
+    static bool is(const Value& value) { return value.isBoolean(); }
+    static bool get(const Value& value) { return value.getBoolean(); }
+    static Value make(bool value) { return Value(value); }
+};
+
+template <std::floating_point T>
+struct NativeType<T>
+{
+    static constexpr std::string_view name = "a number";
+    static bool is(const Value& value) { return value.isNumber(); }
+    static T get(const Value& value) { return static_cast<T>(value.getNumber()); }
+    static Value make(T value) { return Value(static_cast<double>(value)); }
+};
+
+// Integer parameters only take whole numbers the type can hold; fractions, NaN and infinities
+// are rejected rather than truncated. Integers too large for a double are rounded when returned.
+template <std::integral T>
+    requires(!std::is_same_v<T, bool>)
+struct NativeType<T>
+{
+    static constexpr std::string_view name = "an integer";
+    static bool is(const Value& value)
+    {
+        if (!value.isNumber())
+            return false;
+        // Powers of two, so the bounds are exact as doubles.
+        const double end = std::ldexp(1.0, std::numeric_limits<T>::digits);
+        const double start = std::is_signed_v<T> ? -end : 0.0;
+        const double number = value.getNumber();
+        return number >= start && number < end && number == std::trunc(number);
+    }
+    static T get(const Value& value) { return static_cast<T>(value.getNumber()); }
+    static Value make(T value) { return Value(static_cast<double>(value)); }
+};
+
+template <>
+struct NativeType<std::string>
+{
+    static constexpr std::string_view name = "a string";
+    static bool is(const Value& value) { return value.isString(); }
+    static const std::string& get(const Value& value) { return value.getString(); }
+    static Value make(std::string value) { return Value(std::move(value)); }
+};
+
+template <>
+struct NativeType<std::string_view>
+{
+    static constexpr std::string_view name = "a string";
+    static bool is(const Value& value) { return value.isString(); }
+    static std::string_view get(const Value& value) { return value.getString(); }
+    static Value make(std::string_view value) { return Value(LoxString::intern(value)); }
+};
+
+// Arrays are passed by reference, a native changing one changes it for the script too.
+template <>
+struct NativeType<LoxArray>
+{
+    static constexpr std::string_view name = "an array";
+    static bool is(const Value& value) { return value.isArray(); }
+    static LoxArray& get(const Value& value) { return *value.getArray(); }
+    static Value make(LoxArray& value) { return Value(&value); }
+};
+
+// A C++ function called from Lox. The arity and the conversions of the arguments and the result
+// follow from its signature, so a call is the type checks, the function and nothing else: the
+// arguments are read where the engine keeps them and nothing is allocated unless a string is
+// returned. The function may throw NativeError to fail the call. It is a template argument
+// rather than a pointer held by the object, so the call compiles to a direct call.
+template <auto Function, typename Signature = decltype(Function)>
+class BoundNative;
+
+template <auto Function, typename Result, typename... Params>
+class BoundNative<Function, Result (*)(Params...)> : public NativeFunction
+{
+public:
+    int arity() const override { return sizeof...(Params); }
+
+    Value call(std::span<const Value> arguments) override
+    {
+        return call(arguments, std::index_sequence_for<Params...>());
+    }
+
+private:
+    template <typename T>
+    using Type = NativeType<std::remove_cvref_t<T>>;
+
+    template <size_t... Indices>
+    Value call(std::span<const Value> arguments, std::index_sequence<Indices...>)
+    {
+        (check<Params>(arguments[Indices], Indices), ...);
+        if constexpr (std::is_void_v<Result>)
+        {
+            Function(Type<Params>::get(arguments[Indices])...);
+            return Value();
+        }
+        else
+        {
+            return Type<Result>::make(Function(Type<Params>::get(arguments[Indices])...));
+        }
+    }
+
+    template <typename T>
+    static void check(const Value& argument, size_t index)
+    {
+        if (!Type<T>::is(argument))
+            throw NativeError{fmt::format("Argument {} must be {}.", index + 1, Type<T>::name)};
+    }
+};
+
+// Seconds since the interpreter defining it started.
+class Clock : public NativeFunction
+{
+public:
+    Value call(std::span<const Value>) override
+    {
+        std::chrono::duration<double> duration = std::chrono::system_clock::now() - m_startTime;
+        return Value(duration.count());
+    }
+
+    int arity() const override { return 0; }
+
+private:
+    const std::chrono::system_clock::time_point m_startTime = std::chrono::system_clock::now();
+};
+
+// Defines length, push and the bulk operations on numeric arrays, sum, dot, scale and fill, as
+// globals through the engine's defineGlobal.
+void defineArrayNatives(Heap& heap, const std::function<void(std::string_view, const Value&)>& defineGlobal);
@@ -0,0 +1,15 @@
+#include "pch.hpp"
+
+#include "object.hpp"
+
+#include "heap.hpp"
+
+LoxString* LoxString::intern(std::string_view chars)
+{
+    return Heap::get().intern(chars);
+}
+
+LoxString* LoxString::intern(std::string&& chars)
+{
+    return Heap::get().intern(std::move(chars));
+}
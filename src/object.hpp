@@ -0,0 +1,117 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+class Heap;
+
+// Base of every heap object. Objects are owned by the Heap, which frees them once they are no
+// longer reachable, so a Value only needs room for the pointer itself.
+class Obj
+{
+public:
+    enum class Type : uint8_t
+    {
+        String,
+        Callable,
+        Instance,
+        Array,
+        Environment,
+        Upvalue,
+        Shape,
+    };
+
+    explicit Obj(Type type) : type(type) {}
+    Obj(const Obj&) = delete;
+    Obj& operator=(const Obj&) = delete;
+    virtual ~Obj() = default;
+
+    // Marks every object this one references.
+    virtual void trace(Heap& heap) const {}
+    // Memory owned beyond the object itself when it is created, counted towards the heap size.
+    virtual size_t ownedBytes() const { return 0; }
+
+    void pin() { m_pins++; }
+    void unpin() { m_pins--; }
+
+    const Type type;
+
+private:
+    friend class Heap;
+
+    Obj* m_next = nullptr;
+    uint32_t m_pins = 0;
+    uint32_t m_size = 0;
+    mutable bool m_marked = false;
+};
+
+// Keeps an object alive while it is referenced from outside the heap, e.g. by the AST or a
+// compiled chunk. References between objects and from the engines' roots don't need one.
+template <typename T>
+class Ref
+{
+public:
+    Ref() = default;
+    Ref(T* object) : m_object(object)
+    {
+        if (m_object)
+            m_object->pin();
+    }
+    Ref(const Ref& other) : Ref(other.m_object) {}
+    Ref(Ref&& other) noexcept : m_object(std::exchange(other.m_object, nullptr)) {}
+    ~Ref()
+    {
+        if (m_object)
+            m_object->unpin();
+    }
+
+    Ref& operator=(Ref other) noexcept
+    {
+        std::swap(m_object, other.m_object);
+        return *this;
+    }
+
+    T* get() const { return m_object; }
+    T* operator->() const { return m_object; }
+    T& operator*() const { return *m_object; }
+    explicit operator bool() const { return m_object != nullptr; }
+
+    bool operator==(const Ref& other) const { return m_object == other.m_object; }
+
+private:
+    T* m_object = nullptr;
+};
+
+// An immutable string. Every LoxString is interned, so two strings with the same
+// characters are the same object and compare equal by pointer.
+class LoxString : public Obj
+{
+public:
+    // Returns the string with these characters in the current heap, creating it if it isn't
+    // interned yet.
+    static LoxString* intern(std::string_view chars);
+    static LoxString* intern(std::string&& chars);
+    static LoxString* intern(const char* chars) { return intern(std::string_view(chars)); }
+
+    size_t ownedBytes() const override { return chars.capacity(); }
+
+    // Hashes interned strings by their cached hash, they compare by identity.
+    struct Hash
+    {
+        size_t operator()(const LoxString* string) const { return string->hash; }
+    };
+
+    const std::string chars;
+    const size_t hash;
+
+private:
+    friend class Heap;
+
+    LoxString(std::string chars, size_t hash) : Obj(Type::String), chars(std::move(chars)), hash(hash) {}
+};
+
+// Map keyed by interned names, e.g. variables, fields and methods. Objects holding one trace its keys.
+template <typename T>
+using StringMap = std::unordered_map<const LoxString*, T, LoxString::Hash>;
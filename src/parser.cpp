@@ -1,39 +1,36 @@
 #include "pch.hpp"
 
-#include "lox.hpp"
 #include "parser.hpp"
 #include "token.hpp"
 
+#include <charconv>
+#include <limits>
 #include <set>
 
-std::vector<std::unique_ptr<Stmt>> Parser::parse(const std::vector<Token>& tokens)
+void Parser::parse(Ast& ast, ErrorReporter& errors)
 {
-    std::vector<std::unique_ptr<Stmt>> statements;
-
     try
     {
-        Parser parser(tokens);
-        statements = parser.program();
+        Parser parser(ast, errors);
+        ast.statements = parser.program();
     }
     catch (const Error& e)
     {
-        error(e.token, e.message);
+        errors.error(e.token, e.message);
     }
-
-    return statements;
 }
 
-std::vector<std::unique_ptr<Stmt>> Parser::program()
+NodeList<Stmt> Parser::program()
 {
-    std::vector<std::unique_ptr<Stmt>> statements;
+    std::vector<Stmt*> statements;
     while (!isAtEnd())
         statements.emplace_back(declaration());
-    return statements;
+    return m_ast.list(statements);
 }
 
-std::vector<std::unique_ptr<Stmt>> Parser::block()
+NodeList<Stmt> Parser::block()
 {
-    std::vector<std::unique_ptr<Stmt>> statements;
+    std::vector<Stmt*> statements;
 
     while (!isAtEnd() && peek().type != TokenType::RightBrace)
     {
@@ -41,30 +38,36 @@ std::vector<std::unique_ptr<Stmt>> Parser::block()
     }
 
     consume(TokenType::RightBrace, "Expect '}' after block.");
-    return statements;
+    return m_ast.list(statements);
 }
 
-std::unique_ptr<Stmt> Parser::declaration()
+Stmt* Parser::declaration()
 {
+    const int line = peek().line;
+    Stmt* stmt;
     if (match({TokenType::Class}))
-        return classDeclaration();
-    if (match({TokenType::Fun}))
-        return funDeclaration();
-    if (match({TokenType::Var}))
-        return varDeclaration();
-    return statement();
+        stmt = classDeclaration();
+    else if (match({TokenType::Fun}))
+        stmt = funDeclaration();
+    else if (match({TokenType::Var}))
+        stmt = varDeclaration();
+    else
+        stmt = statement();
+
+    stmt->line = line;
+    return stmt;
 }
 
-std::unique_ptr<Stmt> Parser::classDeclaration()
+Stmt* Parser::classDeclaration()
 {
     const auto& name = consume(TokenType::Identifier, "Expecting class name");
-    std::vector<std::unique_ptr<Stmt::Fun>> methods;
+    std::vector<Stmt::Fun*> methods;
     consume(TokenType::LeftBrace, "Expecting '{' before class body");
     while (match({TokenType::Identifier}))
     {
         const Token& methodName = previous();
         consume(TokenType::LeftParen, "Expecting '(' after method name.");
-        std::vector<Token> params;
+        NodeList<const Token> params;
         if (peek().type != TokenType::RightParen)
             params = parameters();
         consume(TokenType::RightParen, "Expecting ')' after method parameters.");
@@ -72,18 +75,19 @@ std::unique_ptr<Stmt> Parser::classDeclaration()
         consume(TokenType::LeftBrace, "Expecting '{' after function declaration.");
         auto body = block();
 
-        methods.emplace_back(std::make_unique<Stmt::Fun>(methodName, std::move(params), std::move(body)));
+        methods.emplace_back(m_ast.make<Stmt::Fun>(methodName, m_ast.symbol(methodName), params, body));
+        methods.back()->line = methodName.line;
     }
     consume(TokenType::RightBrace, "Expecting '}' after class body");
 
-    return std::make_unique<Stmt::Class>(name, std::move(methods));
+    return m_ast.make<Stmt::Class>(name, m_ast.symbol(name), m_ast.list(methods));
 }
 
-std::unique_ptr<Stmt> Parser::funDeclaration()
+Stmt* Parser::funDeclaration()
 {
     const Token& name = consume(TokenType::Identifier, "Expecting identifier after 'fun'.");
     consume(TokenType::LeftParen, "Expecting '(' after function name.");
-    std::vector<Token> params;
+    NodeList<const Token> params;
     if (peek().type != TokenType::RightParen)
         params = parameters();
     consume(TokenType::RightParen, "Expecting ')' after function parameters.");
@@ -91,126 +95,135 @@ std::unique_ptr<Stmt> Parser::funDeclaration()
 
     auto body = block();
 
-    return std::make_unique<Stmt::Fun>(name, std::move(params), std::move(body));
+    return m_ast.make<Stmt::Fun>(name, m_ast.symbol(name), params, body);
 }
 
-std::unique_ptr<Stmt> Parser::varDeclaration()
+Stmt* Parser::varDeclaration()
 {
     const Token& name = consume(TokenType::Identifier, "Expecting variable name");
-    std::unique_ptr<Expr> expr;
+    Expr* expr = nullptr;
 
     if (match({TokenType::Equal}))
     {
         expr = expression();
     }
 
-    auto stmt = std::make_unique<Stmt::Var>(name, std::move(expr));
+    auto stmt = m_ast.make<Stmt::Var>(name, m_ast.symbol(name), expr);
     consume(TokenType::Semicolon, "Expecting ';' after expression");
     return stmt;
 }
 
-std::unique_ptr<Stmt> Parser::statement()
+Stmt* Parser::statement()
 {
+    const int line = peek().line;
+    Stmt* stmt;
     if (match({TokenType::For}))
-        return forStatement();
-    if (match({TokenType::If}))
-        return ifStatement();
-    if (match({TokenType::Print}))
-        return printStatement();
-    if (match({TokenType::While}))
-        return whileStatement();
-    if (match({TokenType::LeftBrace}))
-        return std::make_unique<Stmt::Block>(block());
-    if (match({TokenType::Return}))
-        return returnStatement();
-    return expressionStatement();
-}
-
-std::unique_ptr<Stmt> Parser::printStatement()
+        stmt = forStatement();
+    else if (match({TokenType::If}))
+        stmt = ifStatement();
+    else if (match({TokenType::Print}))
+        stmt = printStatement();
+    else if (match({TokenType::While}))
+        stmt = whileStatement();
+    else if (match({TokenType::LeftBrace}))
+        stmt = m_ast.make<Stmt::Block>(block());
+    else if (match({TokenType::Return}))
+        stmt = returnStatement();
+    else
+        stmt = expressionStatement();
+
+    stmt->line = line;
+    return stmt;
+}
+
+Stmt* Parser::printStatement()
 {
     auto expr = expression();
-    auto stmt = std::make_unique<Stmt::Print>(std::move(expr));
+    auto stmt = m_ast.make<Stmt::Print>(expr);
     consume(TokenType::Semicolon, "Expecting ';' after value");
     return stmt;
 }
 
-std::unique_ptr<Stmt> Parser::expressionStatement()
+Stmt* Parser::expressionStatement()
 {
     auto expr = expression();
-    auto stmt = std::make_unique<Stmt::Expression>(std::move(expr));
+    auto stmt = m_ast.make<Stmt::Expression>(expr);
     consume(TokenType::Semicolon, "Expecting ';' after expression");
     return stmt;
 }
 
-std::unique_ptr<Stmt> Parser::ifStatement()
+Stmt* Parser::ifStatement()
 {
     consume(TokenType::LeftParen, "Expecting '(' after 'if'.");
     auto expr = expression();
     consume(TokenType::RightParen, "Expecting ')' after if condition.");
     auto ifBranch = statement();
 
-    std::unique_ptr<Stmt> elseBranch;
+    Stmt* elseBranch = nullptr;
     if (match({TokenType::Else}))
         elseBranch = statement();
 
-    return std::make_unique<Stmt::If>(std::move(expr), std::move(ifBranch), std::move(elseBranch));
+    return m_ast.make<Stmt::If>(expr, ifBranch, elseBranch);
 }
 
-std::unique_ptr<Stmt> Parser::whileStatement()
+Stmt* Parser::whileStatement()
 {
     consume(TokenType::LeftParen, "Expecting '(' after 'if'.");
     auto expr = expression();
     consume(TokenType::RightParen, "Expecting ')' after if condition.");
     auto body = statement();
 
-    return std::make_unique<Stmt::While>(std::move(expr), std::move(body));
+    return m_ast.make<Stmt::While>(expr, body);
 }
 
-std::unique_ptr<Stmt> Parser::forStatement()
+Stmt* Parser::forStatement()
 {
     consume(TokenType::LeftParen, "Expecting '(' after 'for'.");
 
-    std::unique_ptr<Stmt> initializer;
+    Stmt* initializer = nullptr;
+    const int initializerLine = peek().line;
     if (match({TokenType::Var}))
         initializer = varDeclaration();
     else if (!match({TokenType::Semicolon}))
         initializer = expressionStatement();
+    if (initializer)
+        initializer->line = initializerLine;
 
-    std::unique_ptr<Expr> condition;
+    Expr* condition = nullptr;
     if (peek().type != TokenType::Semicolon)
         condition = expression();
     consume(TokenType::Semicolon, "Expecting ';' after for condition.");
 
-    std::unique_ptr<Expr> step;
+    Expr* step = nullptr;
     if (peek().type != TokenType::RightParen)
         step = expression();
     consume(TokenType::RightParen, "Expecting ')' after for step.");
 
     auto body = statement();
 
-    return std::make_unique<Stmt::For>(std::move(initializer), std::move(condition), std::move(step), std::move(body));
+    return m_ast.make<Stmt::For>(initializer, condition, step, body);
 }
 
-std::unique_ptr<Stmt> Parser::returnStatement()
+Stmt* Parser::returnStatement()
 {
     const Token& keyword = previous();
 
-    std::unique_ptr<Expr> value;
+    Expr* value = nullptr;
     if (peek().type != TokenType::Semicolon)
     {
         value = expression();
     }
 
     consume(TokenType::Semicolon, "Expect ';' after return value.");
-    return std::make_unique<Stmt::Return>(keyword, std::move(value));
+    return m_ast.make<Stmt::Return>(keyword, value);
 }
 
-std::unique_ptr<Expr> Parser::expression()
+Expr* Parser::expression()
 {
     return assignment();
 }
 
-std::unique_ptr<Expr> Parser::assignment()
+Expr* Parser::assignment()
 {
     auto left = logicOr();
     if (match({TokenType::Equal}))
@@ -218,118 +231,125 @@ std::unique_ptr<Expr> Parser::assignment()
         const Token& equalToken = previous();
         auto value = assignment();
 
-        if (auto variableExpr = dynamic_cast<Expr::Variable*>(left.get()); variableExpr != nullptr)
+        if (left->kind == Expr::Kind::Variable)
+        {
+            auto& variableExpr = static_cast<Expr::Variable&>(*left);
+            return m_ast.make<Expr::Assign>(variableExpr.name, variableExpr.symbol, value);
+        }
+        else if (left->kind == Expr::Kind::Get)
         {
-            return std::make_unique<Expr::Assign>(variableExpr->name, std::move(value));
+            auto& getExpr = static_cast<Expr::Get&>(*left);
+            return m_ast.make<Expr::Set>(getExpr.object, getExpr.name, getExpr.symbol, value);
         }
-        else if (auto getExpr = dynamic_cast<Expr::Get*>(left.get()); getExpr != nullptr)
+        else if (left->kind == Expr::Kind::Index)
         {
-            return std::make_unique<Expr::Set>(std::move(getExpr->object), getExpr->name, std::move(value));
+            auto& indexExpr = static_cast<Expr::Index&>(*left);
+            return m_ast.make<Expr::SetIndex>(indexExpr.object, indexExpr.bracket, indexExpr.index, value);
         }
 
-        error(equalToken, "Invalid assignment target");
+        m_errors.error(equalToken, "Invalid assignment target");
     }
 
     return left;
 }
 
-std::unique_ptr<Expr> Parser::logicOr()
+Expr* Parser::logicOr()
 {
-    std::unique_ptr<Expr> expr = logicAnd();
+    Expr* expr = logicAnd();
 
     while (match({TokenType::Or}))
     {
         const Token& op = previous();
-        std::unique_ptr<Expr> right = logicAnd();
-        expr = std::make_unique<Expr::Logical>(std::move(expr), op, std::move(right));
+        Expr* right = logicAnd();
+        expr = m_ast.make<Expr::Logical>(expr, op, right);
     }
 
     return expr;
 }
 
-std::unique_ptr<Expr> Parser::logicAnd()
+Expr* Parser::logicAnd()
 {
-    std::unique_ptr<Expr> expr = equality();
+    Expr* expr = equality();
 
     while (match({TokenType::And}))
     {
         const Token& op = previous();
-        std::unique_ptr<Expr> right = equality();
-        expr = std::make_unique<Expr::Logical>(std::move(expr), op, std::move(right));
+        Expr* right = equality();
+        expr = m_ast.make<Expr::Logical>(expr, op, right);
     }
 
     return expr;
 }
 
-std::unique_ptr<Expr> Parser::equality()
+Expr* Parser::equality()
 {
-    std::unique_ptr<Expr> expr = comparison();
+    Expr* expr = comparison();
 
     while (match({TokenType::EqualEqual, TokenType::BangEqual}))
     {
         const Token& op = previous();
-        std::unique_ptr<Expr> right = comparison();
-        expr = std::make_unique<Expr::Binary>(std::move(expr), op, std::move(right));
+        Expr* right = comparison();
+        expr = m_ast.make<Expr::Binary>(expr, op, right);
     }
 
     return expr;
 }
 
-std::unique_ptr<Expr> Parser::comparison()
+Expr* Parser::comparison()
 {
-    std::unique_ptr<Expr> expr = term();
+    Expr* expr = term();
 
     while (match({TokenType::Greater, TokenType::GreaterEqual, TokenType::Less, TokenType::LessEqual}))
     {
         const Token& op = previous();
-        std::unique_ptr<Expr> right = term();
-        expr = std::make_unique<Expr::Binary>(std::move(expr), op, std::move(right));
+        Expr* right = term();
+        expr = m_ast.make<Expr::Binary>(expr, op, right);
     }
 
     return expr;
 }
 
-std::unique_ptr<Expr> Parser::term()
+Expr* Parser::term()
 {
-    std::unique_ptr<Expr> expr = factor();
+    Expr* expr = factor();
 
     while (match({TokenType::Minus, TokenType::Plus}))
     {
         const Token& op = previous();
-        std::unique_ptr<Expr> right = factor();
-        expr = std::make_unique<Expr::Binary>(std::move(expr), op, std::move(right));
+        Expr* right = factor();
+        expr = m_ast.make<Expr::Binary>(expr, op, right);
     }
 
     return expr;
 }
 
-std::unique_ptr<Expr> Parser::factor()
+Expr* Parser::factor()
 {
-    std::unique_ptr<Expr> expr = unary();
+    Expr* expr = unary();
 
     while (match({TokenType::Slash, TokenType::Star}))
     {
         const Token& op = previous();
-        std::unique_ptr<Expr> right = unary();
-        expr = std::make_unique<Expr::Binary>(std::move(expr), op, std::move(right));
+        Expr* right = unary();
+        expr = m_ast.make<Expr::Binary>(expr, op, right);
     }
 
     return expr;
 }
 
-std::unique_ptr<Expr> Parser::unary()
+Expr* Parser::unary()
 {
     if (match({TokenType::Bang, TokenType::Minus}))
     {
         const Token& op = previous();
-        std::unique_ptr<Expr> right = unary();
-        return std::make_unique<Expr::Unary>(op, std::move(right));
+        Expr* right = unary();
+        return m_ast.make<Expr::Unary>(op, right);
     }
 
     return call();
 }
 
-std::unique_ptr<Expr> Parser::call()
+Expr* Parser::call()
 {
     auto expr = primary();
 
@@ -337,19 +357,25 @@ std::unique_ptr<Expr> Parser::call()
     {
         if (match({TokenType::LeftParen}))
         {
-            std::vector<std::unique_ptr<Expr>> args;
+            NodeList<Expr> args;
             if (peek().type != TokenType::RightParen)
             {
                 args = arguments();
             }
 
             const auto& paren = consume(TokenType::RightParen, "Expecting ')' after arguments");
-            expr = std::make_unique<Expr::Call>(std::move(expr), paren, std::move(args));
+            expr = m_ast.make<Expr::Call>(expr, paren, args);
         }
         else if (match({TokenType::Dot}))
         {
             const Token& name = consume(TokenType::Identifier, "Expecting property name after '.'");
-            expr = std::make_unique<Expr::Get>(std::move(expr), name);
+            expr = m_ast.make<Expr::Get>(expr, name, m_ast.symbol(name));
+        }
+        else if (match({TokenType::LeftBracket}))
+        {
+            auto index = expression();
+            const auto& bracket = consume(TokenType::RightBracket, "Expecting ']' after index");
+            expr = m_ast.make<Expr::Index>(expr, bracket, index);
         }
         else
         {
@@ -360,55 +386,112 @@ std::unique_ptr<Expr> Parser::call()
     return expr;
 }
 
-std::unique_ptr<Expr> Parser::primary()
+Expr* Parser::primary()
 {
     if (match({TokenType::Number, TokenType::String, TokenType::True, TokenType::False, TokenType::Nil}))
-        return std::make_unique<Expr::Literal>(previous());
+        return m_ast.make<Expr::Literal>(previous(), literal(previous()));
 
     if (match({TokenType::This}))
-        return std::make_unique<Expr::This>(previous());
+        return m_ast.make<Expr::This>(previous(), m_ast.symbol(previous()));
 
     if (match({TokenType::Identifier}))
-        return std::make_unique<Expr::Variable>(previous());
+        return m_ast.make<Expr::Variable>(previous(), m_ast.symbol(previous()));
 
     if (match({TokenType::LeftParen}))
     {
-        auto expr = std::make_unique<Expr::Grouping>(expression());
+        auto expr = m_ast.make<Expr::Grouping>(expression());
         consume(TokenType::RightParen, "Expecting ')'");
         return expr;
     }
 
+    if (match({TokenType::LeftBracket}))
+    {
+        NodeList<Expr> list;
+        if (peek().type != TokenType::RightBracket)
+            list = elements();
+        const auto& bracket = consume(TokenType::RightBracket, "Expecting ']' after elements");
+        return m_ast.make<Expr::Array>(bracket, list);
+    }
+
     throw Error(peek(), "Expecting expression");
 }
 
-std::vector<Token> Parser::parameters()
+NodeList<const Token> Parser::parameters()
 {
-    std::vector<Token> tokens;
-    tokens.emplace_back(consume(TokenType::Identifier, "Expecting identifier."));
+    std::vector<const Token*> tokens;
+    tokens.emplace_back(&consume(TokenType::Identifier, "Expecting identifier."));
 
     while (match({TokenType::Comma}))
     {
-        tokens.emplace_back(consume(TokenType::Identifier, "Expecting identifier."));
+        tokens.emplace_back(&consume(TokenType::Identifier, "Expecting identifier."));
         if (tokens.size() >= 255)
-            error(peek(), "Can't have more than 255 parameters.");
+            m_errors.error(peek(), "Can't have more than 255 parameters.");
     }
 
-    return tokens;
+    return m_ast.list(tokens);
 }
 
-std::vector<std::unique_ptr<Expr>> Parser::arguments()
+NodeList<Expr> Parser::arguments()
 {
-    std::vector<std::unique_ptr<Expr>> args;
+    std::vector<Expr*> args;
     args.emplace_back(expression());
 
     while (match({TokenType::Comma}))
     {
         args.emplace_back(expression());
         if (args.size() >= 255)
-            error(peek(), "Can't have more than 255 arguments");
+            m_errors.error(peek(), "Can't have more than 255 arguments");
     }
 
-    return args;
+    return m_ast.list(args);
+}
+
+NodeList<Expr> Parser::elements()
+{
+    std::vector<Expr*> elements;
+    elements.emplace_back(expression());
+
+    while (match({TokenType::Comma}))
+    {
+        elements.emplace_back(expression());
+        if (elements.size() > 255)
+            m_errors.error(peek(), "Can't have more than 255 elements.");
+    }
+
+    return m_ast.list(elements);
+}
+
+Value Parser::literal(const Token& token)
+{
+    switch (token.type)
+    {
+    case TokenType::Nil:
+        return Value();
+    case TokenType::False:
+        return Value(false);
+    case TokenType::True:
+        return Value(true);
+    case TokenType::Number:
+    {
+        double number = 0;
+        const auto [end, ec] = std::from_chars(token.lexeme.data(), token.lexeme.data() + token.lexeme.size(), number);
+        assert(ec != std::errc::invalid_argument && end == token.lexeme.data() + token.lexeme.size());
+        if (ec == std::errc::result_out_of_range)
+        {
+            // Like strtod: too large is infinity, too small to tell from zero is zero. The scanner
+            // only makes digits with an optional fraction, so a nonzero whole part is too large.
+            const auto whole = token.lexeme.substr(0, token.lexeme.find('.'));
+            const bool tooLarge = whole.find_first_not_of('0') != std::string_view::npos;
+            number = tooLarge ? std::numeric_limits<double>::infinity() : 0.0;
+        }
+        return Value(number);
+    }
+    case TokenType::String:
+        return Value(LoxString::intern(token.lexeme.substr(1, token.lexeme.size() - 2)));
+    default:
+        assert(0 && "unreachable");
+        return Value();
+    }
 }
 
 bool Parser::isAtEnd() const
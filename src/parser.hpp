@@ -1,13 +1,13 @@
 #pragma once
 
-#include "expr.hpp"
-#include "stmt.hpp"
+#include "ast.hpp"
 #include "token.hpp"
 
 class Parser
 {
 public:
-    static std::vector<std::unique_ptr<Stmt>> parse(const std::vector<Token>& tokens);
+    // Fills in the tree of an Ast from its tokens.
+    static void parse(Ast& ast, ErrorReporter& errors);
 
 private:
     class Error
@@ -19,41 +19,43 @@ private:
         std::string message;
     };
 
-    Parser(const std::vector<Token>& tokens) : m_tokens(tokens)
+    Parser(Ast& ast, ErrorReporter& errors) : m_ast(ast), m_tokens(ast.tokens), m_errors(errors)
     {
-        assert(tokens.size() > 0);
-        assert(tokens.back().type == TokenType::Eof);
+        assert(m_tokens.size() > 0);
+        assert(m_tokens.back().type == TokenType::Eof);
     }
 
-    std::vector<std::unique_ptr<Stmt>> program();
-    std::vector<std::unique_ptr<Stmt>> block();
+    NodeList<Stmt> program();
+    NodeList<Stmt> block();
 
-    std::unique_ptr<Stmt> declaration();
-    std::unique_ptr<Stmt> classDeclaration();
-    std::unique_ptr<Stmt> funDeclaration();
-    std::unique_ptr<Stmt> varDeclaration();
-    std::unique_ptr<Stmt> statement();
-    std::unique_ptr<Stmt> printStatement();
-    std::unique_ptr<Stmt> expressionStatement();
-    std::unique_ptr<Stmt> ifStatement();
-    std::unique_ptr<Stmt> whileStatement();
-    std::unique_ptr<Stmt> forStatement();
-    std::unique_ptr<Stmt> returnStatement();
+    Stmt* declaration();
+    Stmt* classDeclaration();
+    Stmt* funDeclaration();
+    Stmt* varDeclaration();
+    Stmt* statement();
+    Stmt* printStatement();
+    Stmt* expressionStatement();
+    Stmt* ifStatement();
+    Stmt* whileStatement();
+    Stmt* forStatement();
+    Stmt* returnStatement();
 
-    std::unique_ptr<Expr> expression();
-    std::unique_ptr<Expr> assignment();
-    std::unique_ptr<Expr> logicOr();
-    std::unique_ptr<Expr> logicAnd();
-    std::unique_ptr<Expr> equality();
-    std::unique_ptr<Expr> comparison();
-    std::unique_ptr<Expr> term();
-    std::unique_ptr<Expr> factor();
-    std::unique_ptr<Expr> unary();
-    std::unique_ptr<Expr> call();
-    std::unique_ptr<Expr> primary();
+    Expr* expression();
+    Expr* assignment();
+    Expr* logicOr();
+    Expr* logicAnd();
+    Expr* equality();
+    Expr* comparison();
+    Expr* term();
+    Expr* factor();
+    Expr* unary();
+    Expr* call();
+    Expr* primary();
 
-    std::vector<Token> parameters();
-    std::vector<std::unique_ptr<Expr>> arguments();
+    NodeList<const Token> parameters();
+    NodeList<Expr> arguments();
+    NodeList<Expr> elements();
+    static Value literal(const Token& token);
 
     bool isAtEnd() const;
     const Token& advance();
@@ -63,6 +65,8 @@ private:
     void synchronize();
     const Token& consume(TokenType expected, const char* message);
 
+    Ast& m_ast;
     const std::vector<Token>& m_tokens;
+    ErrorReporter& m_errors;
     int m_current = 0;
 };
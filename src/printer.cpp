@@ -14,7 +14,7 @@ void ExprPrinter::visitGrouping(const Expr::Grouping& expr)
 
 void ExprPrinter::visitLiteral(const Expr::Literal& expr)
 {
-    result = fmt::format("{}", expr.value.lexeme);
+    result = fmt::format("{}", expr.token.lexeme);
 }
 
 void ExprPrinter::visitUnary(const Expr::Unary& expr)
@@ -37,6 +37,47 @@ void ExprPrinter::visitLogical(const Expr::Logical& expr)
     result = fmt::format("({} {} {})", expr.op.lexeme, *expr.left, *expr.right);
 }
 
+void ExprPrinter::visitCall(const Expr::Call& expr)
+{
+    result = fmt::format("(call {}", *expr.callee);
+    for (const auto& arg : expr.arguments)
+        result += fmt::format(" {}", *arg);
+    result += ")";
+}
+
+void ExprPrinter::visitGet(const Expr::Get& expr)
+{
+    result = fmt::format("{}.{}", *expr.object, expr.name.lexeme);
+}
+
+void ExprPrinter::visitSet(const Expr::Set& expr)
+{
+    result = fmt::format("{}.{} = {}", *expr.object, expr.name.lexeme, *expr.value);
+}
+
+void ExprPrinter::visitThis(const Expr::This& expr)
+{
+    result = "this";
+}
+
+void ExprPrinter::visitArray(const Expr::Array& expr)
+{
+    result = "[";
+    for (size_t i = 0; i < expr.elements.size(); i++)
+        result += fmt::format("{}{}", i > 0 ? ", " : "", *expr.elements[i]);
+    result += "]";
+}
+
+void ExprPrinter::visitIndex(const Expr::Index& expr)
+{
+    result = fmt::format("{}[{}]", *expr.object, *expr.index);
+}
+
+void ExprPrinter::visitSetIndex(const Expr::SetIndex& expr)
+{
+    result = fmt::format("{}[{}] = {}", *expr.object, *expr.index, *expr.value);
+}
+
 std::string format_as(const Expr& expr)
 {
     ExprPrinter printer;
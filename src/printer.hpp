@@ -15,6 +15,13 @@ protected:
     void visitVariable(const Expr::Variable& expr) override;
     void visitAssign(const Expr::Assign& expr) override;
     void visitLogical(const Expr::Logical& expr) override;
+    void visitCall(const Expr::Call& expr) override;
+    void visitGet(const Expr::Get& expr) override;
+    void visitSet(const Expr::Set& expr) override;
+    void visitThis(const Expr::This& expr) override;
+    void visitArray(const Expr::Array& expr) override;
+    void visitIndex(const Expr::Index& expr) override;
+    void visitSetIndex(const Expr::SetIndex& expr) override;
 };
 
 std::string format_as(const Expr& expr);
@@ -0,0 +1,137 @@
+#include "pch.hpp"
+
+#include "profiler.hpp"
+
+#include <fstream>
+#include <set>
+#include <unordered_map>
+
+Profiler::Profiler(std::chrono::microseconds interval)
+    : m_frames{{nullptr, 0}},
+      m_lastSample(std::chrono::steady_clock::now()),
+      m_timer(
+          [this, interval](std::stop_token stop)
+          {
+              while (!stop.stop_requested())
+              {
+                  std::this_thread::sleep_for(interval);
+                  m_due.store(true, std::memory_order_relaxed);
+              }
+          })
+{
+}
+
+Profiler::~Profiler()
+{
+    stop();
+}
+
+void Profiler::stop()
+{
+    m_timer.request_stop();
+    if (m_timer.joinable())
+        m_timer.join();
+}
+
+void Profiler::sample()
+{
+    m_due.store(false, std::memory_order_relaxed);
+    const auto now = std::chrono::steady_clock::now();
+    m_samples[m_frames] += now - m_lastSample;
+    m_sampleCount++;
+    m_lastSample = now;
+}
+
+std::string Profiler::frameName(const Stmt::Fun* function)
+{
+    // Functions are told apart by the line they are declared on, e.g. methods of different classes.
+    return function ? fmt::format("{}:{}", function->name.lexeme, function->line) : "<script>";
+}
+
+void Profiler::printReport() const
+{
+    struct Time
+    {
+        Duration self{};
+        Duration total{};
+    };
+
+    Duration elapsed{};
+    std::unordered_map<const Stmt::Fun*, Time> functions;
+    std::map<std::pair<int, const Stmt::Fun*>, Duration> lines;
+    for (const auto& [stack, time] : m_samples)
+    {
+        elapsed += time;
+        functions[stack.back().function].self += time;
+        lines[{stack.back().line, stack.back().function}] += time;
+
+        // Recursive functions are on the stack more than once, but count once towards their total.
+        std::set<const Stmt::Fun*> seen;
+        for (const auto& frame : stack)
+        {
+            if (seen.insert(frame.function).second)
+                functions[frame.function].total += time;
+        }
+    }
+
+    const auto ms = [](Duration time) { return time.count() * 1000; };
+    const auto percent = [&](Duration time) { return elapsed.count() > 0 ? time / elapsed * 100 : 0.0; };
+
+    fmt::println(stderr, "[profile] {} samples over {:.3f} ms", m_sampleCount, ms(elapsed));
+
+    std::vector<std::pair<const Stmt::Fun*, Time>> byFunction(functions.begin(), functions.end());
+    std::sort(byFunction.begin(),
+              byFunction.end(),
+              [](const auto& a, const auto& b) { return a.second.self > b.second.self; });
+    fmt::println(stderr, "[profile] {:>12} {:>7} {:>12} {:>7}  function", "self ms", "self%", "total ms", "total%");
+    for (const auto& [function, time] : byFunction)
+    {
+        fmt::println(stderr,
+                     "[profile] {:12.3f} {:6.1f}% {:12.3f} {:6.1f}%  {}",
+                     ms(time.self),
+                     percent(time.self),
+                     ms(time.total),
+                     percent(time.total),
+                     frameName(function));
+    }
+
+    constexpr size_t HotLines = 10;
+    std::vector<std::pair<std::pair<int, const Stmt::Fun*>, Duration>> byLine(lines.begin(), lines.end());
+    std::sort(byLine.begin(), byLine.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+    byLine.resize(std::min(byLine.size(), HotLines));
+    fmt::println(stderr, "[profile] {:>12} {:>7}  line", "self ms", "self%");
+    for (const auto& [where, time] : byLine)
+    {
+        fmt::println(stderr,
+                     "[profile] {:12.3f} {:6.1f}%  line {} in {}",
+                     ms(time),
+                     percent(time),
+                     where.first,
+                     frameName(where.second));
+    }
+}
+
+bool Profiler::writeFolded(const char* path) const
+{
+    // Stacks that differ only in the lines their frames are at fold into one.
+    std::map<std::string, Duration> folded;
+    for (const auto& [stack, time] : m_samples)
+    {
+        std::string names;
+        for (const auto& frame : stack)
+        {
+            if (!names.empty())
+                names += ';';
+            names += frameName(frame.function);
+        }
+        folded[names] += time;
+    }
+
+    std::ofstream file(path);
+    for (const auto& [names, time] : folded)
+    {
+        // Weighted in microseconds, as flame graph tools expect whole numbers.
+        file << fmt::format("{} {}\n", names, std::chrono::duration_cast<std::chrono::microseconds>(time).count());
+    }
+    return static_cast<bool>(file);
+}
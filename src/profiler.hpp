@@ -0,0 +1,63 @@
+#pragma once
+
+#include "stmt.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <thread>
+
+// Samples the Lox call stack of the tree-walking interpreter. The interpreter keeps a shadow stack
+// of the functions it is running and the line of the statement each of them is at. A timer thread
+// raises a flag every interval and the interpreter takes the sample at its next statement, weighted
+// by the time since the previous one, so slow statements are not undercounted.
+class Profiler
+{
+public:
+    using Duration = std::chrono::duration<double>;
+
+    explicit Profiler(std::chrono::microseconds interval);
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+    ~Profiler();
+
+    void stop();
+
+    void enter(const Stmt::Fun& function) { m_frames.push_back({&function, function.line}); }
+    void leave() { m_frames.pop_back(); }
+    void statement(const Stmt& stmt)
+    {
+        m_frames.back().line = stmt.line;
+        if (m_due.load(std::memory_order_relaxed))
+            sample();
+    }
+    // Drops the calls a runtime error unwound through, back to the top level.
+    void unwind() { m_frames.resize(1); }
+
+    // Self and total time per function and the hottest lines.
+    void printReport() const;
+    // One line per distinct stack, outermost frame first, as flamegraph.pl and speedscope read them.
+    bool writeFolded(const char* path) const;
+
+private:
+    struct Frame
+    {
+        // Null for the top level of the script.
+        const Stmt::Fun* function;
+        int line;
+
+        auto operator<=>(const Frame&) const = default;
+    };
+
+    void sample();
+    static std::string frameName(const Stmt::Fun* function);
+
+    std::vector<Frame> m_frames;
+    // Time spent in each distinct stack.
+    std::map<std::vector<Frame>, Duration> m_samples;
+    size_t m_sampleCount = 0;
+
+    std::chrono::steady_clock::time_point m_lastSample;
+    std::atomic<bool> m_due = false;
+    std::jthread m_timer;
+};
@@ -1,20 +1,14 @@
 #include "pch.hpp"
 
-#include "interpreter.hpp"
-#include "lox.hpp"
 #include "resolver.hpp"
 
-void Resolver::resolve(Interpreter& interpreter, const std::vector<std::unique_ptr<Stmt>>& statements)
+void Resolver::resolve(NodeList<Stmt> statements, ErrorReporter& errors)
 {
-    Resolver resolver(interpreter);
-    resolver.resolve(statements);
+    Resolver resolver(errors);
+    resolver.resolveStmts(statements);
 }
 
-Resolver::Resolver(Interpreter& interpreter) : interpreter(interpreter)
-{
-}
-
-void Resolver::resolve(const std::vector<std::unique_ptr<Stmt>>& statements)
+void Resolver::resolveStmts(NodeList<Stmt> statements)
 {
     for (const auto& stmt : statements)
         resolveStmt(*stmt);
@@ -22,26 +16,31 @@ void Resolver::resolve(const std::vector<std::unique_ptr<Stmt>>& statements)
 
 void Resolver::resolveStmt(const Stmt& stmt)
 {
-    if (const auto* expressionStmt = dynamic_cast<const Stmt::Expression*>(&stmt))
-        return resolveExpressionStmt(*expressionStmt);
-    if (const auto* printStmt = dynamic_cast<const Stmt::Print*>(&stmt))
-        return resolvePrintStmt(*printStmt);
-    if (const auto* varStmt = dynamic_cast<const Stmt::Var*>(&stmt))
-        return resolveVarStmt(*varStmt);
-    if (const auto* blockStmt = dynamic_cast<const Stmt::Block*>(&stmt))
-        return resolveBlockStmt(*blockStmt);
-    if (const auto* ifStmt = dynamic_cast<const Stmt::If*>(&stmt))
-        return resolveIfStmt(*ifStmt);
-    if (const auto* whileStmt = dynamic_cast<const Stmt::While*>(&stmt))
-        return resolveWhileStmt(*whileStmt);
-    if (const auto* forStmt = dynamic_cast<const Stmt::For*>(&stmt))
-        return resolveForStmt(*forStmt);
-    if (const auto* funStmt = dynamic_cast<const Stmt::Fun*>(&stmt))
-        return resolveFunStmt(*funStmt);
-    if (const auto* returnStmt = dynamic_cast<const Stmt::Return*>(&stmt))
-        return resolveReturnStmt(*returnStmt);
-    if (const auto* classStmt = dynamic_cast<const Stmt::Class*>(&stmt))
-        return resolveClassStmt(*classStmt);
+    switch (stmt.kind)
+    {
+    case Stmt::Kind::Expression:
+        return resolveExpressionStmt(static_cast<const Stmt::Expression&>(stmt));
+    case Stmt::Kind::Print:
+        return resolvePrintStmt(static_cast<const Stmt::Print&>(stmt));
+    case Stmt::Kind::Var:
+        return resolveVarStmt(static_cast<const Stmt::Var&>(stmt));
+    case Stmt::Kind::Block:
+        return resolveBlockStmt(static_cast<const Stmt::Block&>(stmt));
+    case Stmt::Kind::If:
+        return resolveIfStmt(static_cast<const Stmt::If&>(stmt));
+    case Stmt::Kind::While:
+        return resolveWhileStmt(static_cast<const Stmt::While&>(stmt));
+    case Stmt::Kind::For:
+        return resolveForStmt(static_cast<const Stmt::For&>(stmt));
+    case Stmt::Kind::Fun:
+        return resolveFunStmt(static_cast<const Stmt::Fun&>(stmt));
+    case Stmt::Kind::Return:
+        return resolveReturnStmt(static_cast<const Stmt::Return&>(stmt));
+    case Stmt::Kind::Class:
+        return resolveClassStmt(static_cast<const Stmt::Class&>(stmt));
+    }
+
+    assert(0 && "unreachable");
 }
 
 void Resolver::resolveExpressionStmt(const Stmt::Expression& stmt)
@@ -56,7 +55,7 @@ void Resolver::resolvePrintStmt(const Stmt::Print& stmt)
 
 void Resolver::resolveVarStmt(const Stmt::Var& stmt)
 {
-    declare(stmt.name);
+    stmt.slot = declare(stmt.name);
     if (stmt.expression)
         resolveExpr(*stmt.expression);
     define(stmt.name);
@@ -65,8 +64,9 @@ void Resolver::resolveVarStmt(const Stmt::Var& stmt)
 void Resolver::resolveBlockStmt(const Stmt::Block& stmt)
 {
     beginScope();
-    resolve(stmt.statements);
-    endScope();
+    stmt.usesFrame = m_scopes.back().inFrame;
+    resolveStmts(stmt.statements);
+    stmt.slotCount = endScope();
 }
 
 void Resolver::resolveIfStmt(const Stmt::If& stmt)
@@ -97,7 +97,8 @@ void Resolver::resolveForStmt(const Stmt::For& stmt)
 
 void Resolver::resolveFunStmt(const Stmt::Fun& stmt)
 {
-    declare(stmt.name);
+    // Never in a frame: a function declaring functions has none.
+    stmt.slot = declare(stmt.name).index;
     define(stmt.name);
     resolveFunction(stmt, FunctionType::Function);
 }
@@ -105,50 +106,67 @@ void Resolver::resolveFunStmt(const Stmt::Fun& stmt)
 void Resolver::resolveReturnStmt(const Stmt::Return& stmt)
 {
     if (m_currentType == FunctionType::None)
-        error(stmt.keyword, "Can't return from top-level code.");
+        m_errors.error(stmt.keyword, "Can't return from top-level code.");
+
+    if (!stmt.value)
+        return;
 
-    if (stmt.value)
-        resolveExpr(*stmt.value);
+    resolveExpr(*stmt.value);
+    if (m_currentType == FunctionType::None)
+        return;
+    const Expr* value = stmt.value;
+    while (value->kind == Expr::Kind::Grouping)
+        value = static_cast<const Expr::Grouping*>(value)->expression;
+    if (value->kind == Expr::Kind::Call)
+        stmt.tailCall = static_cast<const Expr::Call*>(value);
 }
 
 void Resolver::resolveClassStmt(const Stmt::Class& stmt)
 {
-    declare(stmt.name);
+    stmt.slot = declare(stmt.name).index;
     define(stmt.name);
 
-    beginScope();
-    m_scopes.back().insert({"this", true});
-
     for (const auto& method : stmt.methods)
     {
         resolveFunction(*method, FunctionType::Method);
     }
-
-    endScope();
 }
 
 void Resolver::resolveExpr(const Expr& expr)
 {
-    if (const auto* binaryExpr = dynamic_cast<const Expr::Binary*>(&expr))
-        return resolveBinaryExpr(*binaryExpr);
-    if (const auto* groupingExpr = dynamic_cast<const Expr::Grouping*>(&expr))
-        return resolveGroupingExpr(*groupingExpr);
-    if (const auto* literalExpr = dynamic_cast<const Expr::Literal*>(&expr))
-        return resolveLiteralExpr(*literalExpr);
-    if (const auto* unaryExpr = dynamic_cast<const Expr::Unary*>(&expr))
-        return resolveUnaryExpr(*unaryExpr);
-    if (const auto* variableExpr = dynamic_cast<const Expr::Variable*>(&expr))
-        return resolveVariableExpr(*variableExpr);
-    if (const auto* assignExpr = dynamic_cast<const Expr::Assign*>(&expr))
-        return resolveAssignExpr(*assignExpr);
-    if (const auto* logicalExpr = dynamic_cast<const Expr::Logical*>(&expr))
-        return resolveLogicalExpr(*logicalExpr);
-    if (const auto* callExpr = dynamic_cast<const Expr::Call*>(&expr))
-        return resolveCallExpr(*callExpr);
-    if (const auto* getExpr = dynamic_cast<const Expr::Get*>(&expr))
-        return resolveGetExpr(*getExpr);
-    if (const auto* thisExpr = dynamic_cast<const Expr::This*>(&expr))
-        return resolveThisExpr(*thisExpr);
+    switch (expr.kind)
+    {
+    case Expr::Kind::Binary:
+        return resolveBinaryExpr(static_cast<const Expr::Binary&>(expr));
+    case Expr::Kind::Grouping:
+        return resolveGroupingExpr(static_cast<const Expr::Grouping&>(expr));
+    case Expr::Kind::Literal:
+        return resolveLiteralExpr(static_cast<const Expr::Literal&>(expr));
+    case Expr::Kind::Unary:
+        return resolveUnaryExpr(static_cast<const Expr::Unary&>(expr));
+    case Expr::Kind::Variable:
+        return resolveVariableExpr(static_cast<const Expr::Variable&>(expr));
+    case Expr::Kind::Assign:
+        return resolveAssignExpr(static_cast<const Expr::Assign&>(expr));
+    case Expr::Kind::Logical:
+        return resolveLogicalExpr(static_cast<const Expr::Logical&>(expr));
+    case Expr::Kind::Call:
+        return resolveCallExpr(static_cast<const Expr::Call&>(expr));
+    case Expr::Kind::Get:
+        return resolveGetExpr(static_cast<const Expr::Get&>(expr));
+    case Expr::Kind::Set:
+        return resolveSetExpr(static_cast<const Expr::Set&>(expr));
+    case Expr::Kind::This:
+        return resolveThisExpr(static_cast<const Expr::This&>(expr));
+    case Expr::Kind::Array:
+        return resolveArrayExpr(static_cast<const Expr::Array&>(expr));
+    case Expr::Kind::Index:
+        return resolveIndexExpr(static_cast<const Expr::Index&>(expr));
+    case Expr::Kind::SetIndex:
+        return resolveSetIndexExpr(static_cast<const Expr::SetIndex&>(expr));
+    }
+
+    assert(0 && "unreachable");
 }
 
 void Resolver::resolveBinaryExpr(const Expr::Binary& expr)
@@ -177,19 +195,19 @@ void Resolver::resolveVariableExpr(const Expr::Variable& expr)
     if (!m_scopes.empty())
     {
         const auto& scope = m_scopes.back();
-        if (auto it = scope.find(expr.name.lexeme); it != scope.end() && it->second == false)
+        if (int index = findLocal(scope, expr.name); index != -1 && !scope.locals[index].defined)
         {
-            error(expr.name, "Can't read local variable in its own initializer.");
+            m_errors.error(expr.name, "Can't read local variable in its own initializer.");
         }
     }
 
-    resolveLocal(expr, expr.name);
+    resolveLocal(expr.slot, expr.name);
 }
 
 void Resolver::resolveAssignExpr(const Expr::Assign& expr)
 {
     resolveExpr(*expr.value);
-    resolveLocal(expr, expr.name);
+    resolveLocal(expr.slot, expr.name);
 }
 
 void Resolver::resolveLogicalExpr(const Expr::Logical& expr)
@@ -219,28 +237,62 @@ void Resolver::resolveSetExpr(const Expr::Set& expr)
 
 void Resolver::resolveThisExpr(const Expr::This& expr)
 {
-    resolveLocal(expr, expr.keyword);
+    resolveLocal(expr.slot, expr.keyword);
+}
+
+void Resolver::resolveArrayExpr(const Expr::Array& expr)
+{
+    for (const auto& element : expr.elements)
+        resolveExpr(*element);
+}
+
+void Resolver::resolveIndexExpr(const Expr::Index& expr)
+{
+    resolveExpr(*expr.object);
+    resolveExpr(*expr.index);
+}
+
+void Resolver::resolveSetIndexExpr(const Expr::SetIndex& expr)
+{
+    resolveExpr(*expr.object);
+    resolveExpr(*expr.index);
+    resolveExpr(*expr.value);
 }
 
 void Resolver::beginScope()
 {
-    m_scopes.emplace_back();
+    // Blocks share the frame of their function, after the locals declared around them.
+    Scope scope;
+    if (!m_scopes.empty() && m_scopes.back().inFrame)
+    {
+        scope.inFrame = true;
+        scope.frameBase = m_scopes.back().frameBase + m_scopes.back().locals.size();
+    }
+    m_scopes.push_back(std::move(scope));
 }
 
-void Resolver::endScope()
+int Resolver::endScope()
 {
+    const int slotCount = m_scopes.back().locals.size();
     m_scopes.pop_back();
+    return slotCount;
 }
 
-void Resolver::declare(const Token& name)
+VarSlot Resolver::declare(const Token& name)
 {
     if (m_scopes.empty())
-        return;
+        return {};
 
     auto& scope = m_scopes.back();
-    if (scope.contains(name.lexeme))
-        error(name, "Already a variable with this name in this scope.");
-    scope[name.lexeme] = false;
+    if (findLocal(scope, name) != -1)
+        m_errors.error(name, "Already a variable with this name in this scope.");
+    scope.locals.push_back({name.lexeme, false});
+    const int index = scope.locals.size() - 1;
+    if (!scope.inFrame)
+        return {0, index};
+
+    m_frameSize = std::max(m_frameSize, scope.frameBase + index + 1);
+    return {VarSlot::Frame, scope.frameBase + index};
 }
 
 void Resolver::define(const Token& name)
@@ -249,32 +301,95 @@ void Resolver::define(const Token& name)
         return;
 
     auto& scope = m_scopes.back();
-    scope[name.lexeme] = true;
+    scope.locals[findLocal(scope, name)].defined = true;
 }
 
-void Resolver::resolveLocal(const Expr& expr, const Token& name)
+void Resolver::resolveLocal(VarSlot& slot, const Token& name)
 {
+    // Only scopes with an environment count towards the depth.
+    int depth = 0;
     for (int i = m_scopes.size() - 1; i >= 0; i--)
     {
-        if (m_scopes[i].contains(name.lexeme))
+        const auto& scope = m_scopes[i];
+        if (int index = findLocal(scope, name); index != -1)
         {
-            interpreter.resolve(expr, m_scopes.size() - 1 - i);
+            slot = scope.inFrame ? VarSlot{VarSlot::Frame, scope.frameBase + index} : VarSlot{depth, index};
             return;
         }
+        if (!scope.inFrame)
+            depth++;
+    }
+}
+
+int Resolver::findLocal(const Scope& scope, const Token& name)
+{
+    for (int i = scope.locals.size() - 1; i >= 0; i--)
+    {
+        if (scope.locals[i].name == name.lexeme)
+            return i;
+    }
+
+    return -1;
+}
+
+bool Resolver::createsClosures(NodeList<Stmt> statements)
+{
+    return std::ranges::any_of(statements, [](const Stmt* stmt) { return createsClosures(stmt); });
+}
+
+bool Resolver::createsClosures(const Stmt* stmt)
+{
+    if (!stmt)
+        return false;
+
+    switch (stmt->kind)
+    {
+    case Stmt::Kind::Fun:
+    case Stmt::Kind::Class:
+        return true;
+    case Stmt::Kind::Block:
+        return createsClosures(static_cast<const Stmt::Block*>(stmt)->statements);
+    case Stmt::Kind::If:
+    {
+        const auto* ifStmt = static_cast<const Stmt::If*>(stmt);
+        return createsClosures(ifStmt->ifBranch) || createsClosures(ifStmt->elseBranch);
+    }
+    case Stmt::Kind::While:
+        return createsClosures(static_cast<const Stmt::While*>(stmt)->body);
+    case Stmt::Kind::For:
+    {
+        const auto* forStmt = static_cast<const Stmt::For*>(stmt);
+        return createsClosures(forStmt->initializer) || createsClosures(forStmt->body);
+    }
+    default:
+        return false;
     }
 }
 
 void Resolver::resolveFunction(const Stmt::Fun& function, FunctionType type)
 {
     FunctionType enclosingType = m_currentType;
+    const int enclosingFrameSize = m_frameSize;
     m_currentType = type;
-    beginScope();
-    for (const auto& param : function.params)
+
+    // Nothing outlives a call of a function that declares no functions or classes, so its locals
+    // go in a frame on the interpreter's stack, popped when it returns, instead of an environment.
+    Scope scope;
+    scope.inFrame = function.usesFrame = !createsClosures(function.body);
+    m_scopes.push_back(std::move(scope));
+    // A method's receiver is in the first slot, like a parameter before the declared ones. Other
+    // functions have themselves there, under no name.
+    m_scopes.back().locals.push_back({type == FunctionType::Method ? "this" : "", true});
+    m_frameSize = 1;
+    for (const auto* param : function.params)
     {
-        declare(param);
-        define(param);
+        declare(*param);
+        define(*param);
     }
-    resolve(function.body);
-    endScope();
+    resolveStmts(function.body);
+    const int slotCount = endScope();
+    function.slotCount = function.usesFrame ? m_frameSize : slotCount;
+
+    m_frameSize = enclosingFrameSize;
     m_currentType = enclosingType;
 }
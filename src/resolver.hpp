@@ -1,17 +1,16 @@
 #pragma once
 
+#include "error.hpp"
 #include "expr.hpp"
 #include "stmt.hpp"
 #include "token.hpp"
 
-#include <unordered_map>
-
-class Interpreter;
-
+// Checks scoping rules and assigns every local variable a slot in its scope's environment, or
+// in the frame of its function when nothing in the function can capture it.
 class Resolver
 {
 public:
-    static void resolve(Interpreter& interpreter, const std::vector<std::unique_ptr<Stmt>>& statements);
+    static void resolve(NodeList<Stmt> statements, ErrorReporter& errors);
 
 private:
     enum class FunctionType
@@ -21,9 +20,23 @@ private:
         Method,
     };
 
-    Resolver(Interpreter& interpreter);
+    struct Local
+    {
+        std::string_view name;
+        bool defined;
+    };
+
+    struct Scope
+    {
+        std::vector<Local> locals;
+        // The locals are in the function's frame, at frameBase on, instead of an environment.
+        bool inFrame = false;
+        int frameBase = 0;
+    };
+
+    Resolver(ErrorReporter& errors) : m_errors(errors) {}
 
-    void resolve(const std::vector<std::unique_ptr<Stmt>>& statements);
+    void resolveStmts(NodeList<Stmt> statements);
 
     void resolveStmt(const Stmt& stmt);
     void resolveExpressionStmt(const Stmt::Expression& stmt);
@@ -49,17 +62,25 @@ private:
     void resolveGetExpr(const Expr::Get& expr);
     void resolveSetExpr(const Expr::Set& expr);
     void resolveThisExpr(const Expr::This& expr);
+    void resolveArrayExpr(const Expr::Array& expr);
+    void resolveIndexExpr(const Expr::Index& expr);
+    void resolveSetIndexExpr(const Expr::SetIndex& expr);
 
     void beginScope();
-    void endScope();
+    int endScope();
 
-    void declare(const Token& name);
+    VarSlot declare(const Token& name);
     void define(const Token& name);
 
     void resolveFunction(const Stmt::Fun& function, FunctionType type);
-    void resolveLocal(const Expr& expr, const Token& name);
+    void resolveLocal(VarSlot& slot, const Token& name);
+    static int findLocal(const Scope& scope, const Token& name);
+    static bool createsClosures(NodeList<Stmt> statements);
+    static bool createsClosures(const Stmt* stmt);
 
-    Interpreter& interpreter;
-    std::vector<std::unordered_map<std::string, bool>> m_scopes;
-    FunctionType m_currentType;
+    ErrorReporter& m_errors;
+    std::vector<Scope> m_scopes;
+    FunctionType m_currentType = FunctionType::None;
+    // Slots used so far by the frame of the function being resolved.
+    int m_frameSize = 0;
 };
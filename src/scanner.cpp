@@ -2,28 +2,182 @@
 
 #include "scanner.hpp"
 
-#include "lox.hpp"
 #include "token.hpp"
 
-#include <cctype>
-#include <unordered_map>
+#include <bit>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+enum CharClass : uint8_t
+{
+    Digit = 1,
+    Alpha = 2,
+    Whitespace = 4,
+};
+
+// Classes of every byte. Identifiers are ASCII, bytes outside it belong to no class.
+static constexpr auto charClasses = []()
+{
+    std::array<uint8_t, 256> classes{};
+    for (int c = '0'; c <= '9'; c++)
+        classes[c] = Digit;
+    for (int c = 'a'; c <= 'z'; c++)
+        classes[c] = classes[c - 'a' + 'A'] = Alpha;
+    classes['_'] = Alpha;
+    for (char c : {' ', '\r', '\t', '\n'})
+        classes[c] = Whitespace;
+    return classes;
+}();
 
 static bool isDigit(char c)
 {
-    return c >= '0' && c <= '9';
+    return charClasses[static_cast<uint8_t>(c)] & Digit;
 }
 
 static bool isAlpha(char c)
 {
-    return std::isalpha(c) || c == '_';
+    return charClasses[static_cast<uint8_t>(c)] & Alpha;
 }
 
 static bool isAlphaNum(char c)
 {
-    return isAlpha(c) || isDigit(c);
+    return charClasses[static_cast<uint8_t>(c)] & (Alpha | Digit);
+}
+
+static bool isWhitespace(char c)
+{
+    return charClasses[static_cast<uint8_t>(c)] & Whitespace;
+}
+
+#ifdef __SSE2__
+
+// Per byte of a block: whether it ends the run being skipped, and whether it is a newline.
+struct BlockMasks
+{
+    uint32_t stop;
+    uint32_t newlines;
+};
+
+static __m128i bytesEqual(__m128i block, char c)
+{
+    return _mm_cmpeq_epi8(block, _mm_set1_epi8(c));
+}
+
+// Bytes within [low, high]. Compares are signed, so bytes above 0x7f are never in an ASCII range.
+static __m128i bytesInRange(__m128i block, char low, char high)
+{
+    return _mm_and_si128(
+        _mm_cmpgt_epi8(block, _mm_set1_epi8(low - 1)), _mm_cmplt_epi8(block, _mm_set1_epi8(high + 1))
+    );
+}
+
+static uint32_t bitmask(__m128i bytes)
+{
+    return static_cast<uint32_t>(_mm_movemask_epi8(bytes));
+}
+
+#endif
+
+// Advances from `it` past the bytes for which `inRun` holds and counts the newlines passed. Where
+// SSE2 is available it checks 16 bytes at a time with `block`, which computes the same per byte.
+template <typename Block, typename InRun>
+static const char* skipRun(const char* it, const char* end, int& lines, Block block, InRun inRun)
+{
+#ifdef __SSE2__
+    while (end - it >= 16)
+    {
+        const auto masks = block(_mm_loadu_si128(reinterpret_cast<const __m128i*>(it)));
+        if (masks.stop)
+        {
+            const int length = std::countr_zero(masks.stop);
+            lines += std::popcount(masks.newlines & ((1u << length) - 1));
+            return it + length;
+        }
+        lines += std::popcount(masks.newlines);
+        it += 16;
+    }
+#endif
+
+    for (; it != end && inRun(*it); it++)
+    {
+        if (*it == '\n')
+            lines++;
+    }
+    return it;
+}
+
+static const char* skipWhitespace(const char* it, const char* end, int& lines)
+{
+    return skipRun(
+        it,
+        end,
+        lines,
+#ifdef __SSE2__
+        [](__m128i block)
+        {
+            const auto newlines = bytesEqual(block, '\n');
+            const auto spaces = _mm_or_si128(
+                _mm_or_si128(bytesEqual(block, ' '), bytesEqual(block, '\t')),
+                _mm_or_si128(bytesEqual(block, '\r'), newlines)
+            );
+            return BlockMasks{~bitmask(spaces) & 0xffff, bitmask(newlines)};
+        },
+#else
+        nullptr,
+#endif
+        isWhitespace
+    );
 }
 
-static const std::unordered_map<std::string_view, TokenType> keywords{
+static const char* skipIdentifier(const char* it, const char* end)
+{
+    int lines = 0;
+    return skipRun(
+        it,
+        end,
+        lines,
+#ifdef __SSE2__
+        [](__m128i block)
+        {
+            // Setting bit 5 maps upper case letters to lower case and keeps the rest out of a-z.
+            const auto letters = bytesInRange(_mm_or_si128(block, _mm_set1_epi8(0x20)), 'a', 'z');
+            const auto digits = bytesInRange(block, '0', '9');
+            const auto chars = _mm_or_si128(_mm_or_si128(letters, digits), bytesEqual(block, '_'));
+            return BlockMasks{~bitmask(chars) & 0xffff, 0};
+        },
+#else
+        nullptr,
+#endif
+        isAlphaNum
+    );
+}
+
+// Skips to the end of the line, or the closing quote of a string, counting the lines passed.
+static const char* skipUntil(char last, const char* it, const char* end, int& lines)
+{
+    return skipRun(
+        it,
+        end,
+        lines,
+#ifdef __SSE2__
+        [last](__m128i block)
+        { return BlockMasks{bitmask(bytesEqual(block, last)), bitmask(bytesEqual(block, '\n'))}; },
+#else
+        nullptr,
+#endif
+        [last](char c) { return c != last; }
+    );
+}
+
+struct Keyword
+{
+    std::string_view text;
+    TokenType type;
+};
+
+static constexpr Keyword keywords[] = {
     {"and", TokenType::And},
     {"class", TokenType::Class},
     {"else", TokenType::Else},
@@ -42,21 +196,52 @@ static const std::unordered_map<std::string_view, TokenType> keywords{
     {"while", TokenType::While},
 };
 
-std::vector<Token> Scanner::scanTokens(std::string_view source)
+// Perfect hash of the keywords: no two of them share a bucket, so a lookup is one comparison.
+static constexpr size_t keywordHash(std::string_view text)
+{
+    return (static_cast<uint8_t>(text.front()) + 5 * static_cast<uint8_t>(text.back()) + text.size()) % 32;
+}
+
+static constexpr auto keywordTable = []()
 {
-    Scanner scanner(source);
+    std::array<Keyword, 32> table{};
+    for (const auto& keyword : keywords)
+    {
+        auto& bucket = table[keywordHash(keyword.text)];
+        if (!bucket.text.empty())
+            throw "keyword hash collision";
+        bucket = keyword;
+    }
+    return table;
+}();
+
+static TokenType identifierType(std::string_view text)
+{
+    const auto& keyword = keywordTable[keywordHash(text)];
+    return keyword.text == text ? keyword.type : TokenType::Identifier;
+}
+
+std::vector<Token> Scanner::scanTokens(std::string_view source, ErrorReporter& errors)
+{
+    Scanner scanner(source, errors);
     return scanner.scanTokens();
 }
 
 std::vector<Token> Scanner::scanTokens()
 {
-    while (!isAtEnd())
+    // Scripts average more than four bytes per token, so this saves most of the regrowing.
+    m_tokens.reserve(m_source.size() / 4);
+    while (true)
     {
+        m_current = skipWhitespace(position(), end(), m_line) - m_source.data();
+        if (isAtEnd())
+            break;
+
         m_start = m_current;
         scanToken();
     }
 
-    m_tokens.push_back(Token(TokenType::Eof, "", m_line));
+    m_tokens.push_back(Token(TokenType::Eof, m_source.substr(m_source.size()), m_line));
     return std::move(m_tokens);
 }
 
@@ -77,6 +262,12 @@ void Scanner::scanToken()
     case '}':
         addToken(TokenType::RightBrace);
         break;
+    case '[':
+        addToken(TokenType::LeftBracket);
+        break;
+    case ']':
+        addToken(TokenType::RightBracket);
+        break;
     case ',':
         addToken(TokenType::Comma);
         break;
@@ -110,19 +301,13 @@ void Scanner::scanToken()
     case '/':
         if (match('/'))
         {
-            while (peek() != '\n' && !isAtEnd())
-                advance();
+            int lines = 0;
+            m_current = skipUntil('\n', position(), end(), lines) - m_source.data();
         }
         else
         {
             addToken(TokenType::Slash);
         }
-    case ' ':
-    case '\r':
-    case '\t':
-        break;
-    case '\n':
-        m_line++;
         break;
 
     case '"':
@@ -135,29 +320,23 @@ void Scanner::scanToken()
         else if (isAlpha(c))
             scanIdentifierToken();
         else
-            error(m_line, "Unexpected character.");
+            m_errors.error(m_line, "Unexpected character.");
     }
     // TODO
 }
 
 void Scanner::addToken(TokenType type)
 {
-    std::string lexeme(m_source.substr(m_start, m_current - m_start));
-    m_tokens.emplace_back(type, lexeme, m_line);
+    m_tokens.emplace_back(type, m_source.substr(m_start, m_current - m_start), m_line);
 }
 
 void Scanner::scanStringToken()
 {
-    while (peek() != '"' && !isAtEnd())
-    {
-        if (peek() == '\n')
-            m_line++;
-        advance();
-    }
+    m_current = skipUntil('"', position(), end(), m_line) - m_source.data();
 
     if (isAtEnd())
     {
-        error(m_line, "Unterminated string.");
+        m_errors.error(m_line, "Unterminated string.");
         return;
     }
 
@@ -184,14 +363,8 @@ void Scanner::scanNumberToken()
 
 void Scanner::scanIdentifierToken()
 {
-    while (isAlphaNum(peek()))
-        advance();
-
-    const auto text = m_source.substr(m_start, m_current - m_start);
-    if (auto it = keywords.find(text); it != keywords.end())
-        addToken(it->second);
-    else
-        addToken(TokenType::Identifier);
+    m_current = skipIdentifier(position(), end()) - m_source.data();
+    addToken(identifierType(m_source.substr(m_start, m_current - m_start)));
 }
 
 bool Scanner::isAtEnd() const
@@ -1,14 +1,15 @@
 #pragma once
 
+#include "error.hpp"
 #include "token.hpp"
 
 class Scanner
 {
 public:
-    static std::vector<Token> scanTokens(std::string_view source);
+    static std::vector<Token> scanTokens(std::string_view source, ErrorReporter& errors);
 
 private:
-    Scanner(std::string_view source) : m_source(source) {}
+    Scanner(std::string_view source, ErrorReporter& errors) : m_source(source), m_errors(errors) {}
 
     std::vector<Token> scanTokens();
     void scanToken();
@@ -22,8 +23,11 @@ private:
     bool match(char expected);
     char peek() const;
     char peekNext() const;
+    const char* position() const { return m_source.data() + m_current; }
+    const char* end() const { return m_source.data() + m_source.size(); }
 
     std::string_view m_source;
+    ErrorReporter& m_errors;
     std::vector<Token> m_tokens;
 
     int m_start = 0;
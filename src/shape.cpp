@@ -0,0 +1,32 @@
+#include "pch.hpp"
+
+#include "shape.hpp"
+
+#include "heap.hpp"
+
+Shape::Shape(const Shape& parent, const LoxString* name) : Obj(Type::Shape), m_slots(parent.m_slots)
+{
+    m_slots.emplace(name, fieldCount());
+}
+
+int Shape::find(const LoxString* name) const
+{
+    auto it = m_slots.find(name);
+    return it != m_slots.end() ? it->second : -1;
+}
+
+Shape* Shape::withField(const LoxString* name)
+{
+    auto [it, inserted] = m_transitions.try_emplace(name, nullptr);
+    if (inserted)
+        it->second = Heap::get().make<Shape>(*this, name);
+    return it->second;
+}
+
+void Shape::trace(Heap& heap) const
+{
+    for (const auto& [name, slot] : m_slots)
+        heap.mark(name);
+    for (const auto& [name, shape] : m_transitions)
+        heap.mark(shape);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "object.hpp"
+
+#include <array>
+
+class ICallable;
+
+// A hidden class: the layout of the fields of an instance. Instances of a class start with the
+// class's empty shape and move to a child shape each time they get a new field, so instances
+// that got the same fields in the same order share a shape and store their fields at the same slots.
+class Shape : public Obj
+{
+public:
+    Shape() : Obj(Type::Shape) {}
+
+    // Slot of the field, or -1 if instances of this shape don't have it.
+    int find(const LoxString* name) const;
+    // The shape after adding the field, created the first time it is needed and shared afterwards.
+    Shape* withField(const LoxString* name);
+
+    int fieldCount() const { return m_slots.size(); }
+
+    void trace(Heap& heap) const override;
+
+private:
+    friend class Heap;
+
+    Shape(const Shape& parent, const LoxString* name);
+
+    StringMap<int> m_slots;
+    StringMap<Shape*> m_transitions;
+};
+
+// What a property access found: a field at a slot, or a method of the class.
+struct Property
+{
+    int slot = -1;
+    ICallable* method = nullptr;
+
+    bool isField() const { return slot >= 0; }
+    bool isMethod() const { return method != nullptr; }
+};
+
+// Inline cache of a property access site, remembering the result for the last few shapes seen.
+// A shape belongs to one class, so it decides both where a field is and which method a name
+// refers to. Once full the site is megamorphic and misses go to the shape lookup.
+struct PropertyCache
+{
+    static constexpr int Size = 4;
+
+    struct Entry
+    {
+        // Pinned so a freed shape's address can't be reused by another shape while cached here.
+        Ref<Shape> shape;
+        Property property;
+        // For a store adding a field: the shape the instance moves to.
+        Shape* transition = nullptr;
+    };
+
+    const Entry* find(const Shape* shape) const
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (entries[i].shape.get() == shape)
+                return &entries[i];
+        }
+        return nullptr;
+    }
+
+    void add(Entry entry)
+    {
+        if (count < Size)
+            entries[count++] = std::move(entry);
+    }
+
+    std::array<Entry, Size> entries;
+    int count = 0;
+};
@@ -0,0 +1,65 @@
+#include "pch.hpp"
+
+#include "source.hpp"
+
+#include <utility>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define LOX_HAS_MMAP 1
+#else
+#include <fstream>
+#include <iterator>
+#endif
+
+Source::Source(Source&& other) noexcept
+    : m_text(std::move(other.m_text)),
+      m_mapping(std::exchange(other.m_mapping, nullptr)),
+      m_size(std::exchange(other.m_size, 0))
+{
+}
+
+Source::~Source()
+{
+#ifdef LOX_HAS_MMAP
+    if (m_mapping)
+        munmap(const_cast<char*>(m_mapping), m_size);
+#endif
+}
+
+std::optional<Source> Source::load(const char* path)
+{
+#ifdef LOX_HAS_MMAP
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return std::nullopt;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            close(fd);
+            return Source(static_cast<const char*>(mapping), info.st_size);
+        }
+    }
+
+    // Pipes, empty files and anything else that can't be mapped.
+    std::string text;
+    char buffer[64 * 1024];
+    ssize_t count;
+    while ((count = read(fd, buffer, sizeof(buffer))) > 0)
+        text.append(buffer, count);
+    close(fd);
+    return Source(std::move(text));
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return std::nullopt;
+    return Source(std::string(std::istreambuf_iterator<char>(file), {}));
+#endif
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <optional>
+
+// The text of a script. Files are mapped into memory where possible, so the scanner reads them
+// in place instead of from a copy.
+class Source
+{
+public:
+    explicit Source(std::string text) : m_text(std::move(text)) {}
+    Source(Source&& other) noexcept;
+    Source& operator=(Source&& other) = delete;
+    ~Source();
+
+    // Maps the file, or reads it if it can't be mapped, e.g. a pipe. Empty if it can't be opened.
+    static std::optional<Source> load(const char* path);
+
+    std::string_view text() const { return m_mapping ? std::string_view(m_mapping, m_size) : m_text; }
+
+private:
+    Source(const char* mapping, size_t size) : m_mapping(mapping), m_size(size) {}
+
+    std::string m_text;
+    const char* m_mapping = nullptr;
+    size_t m_size = 0;
+};
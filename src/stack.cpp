@@ -0,0 +1,141 @@
+#include "pch.hpp"
+
+#include "stack.hpp"
+
+#include <utility>
+
+#ifdef LOX_SWITCH_STACK
+#include <sys/mman.h>
+#include <unistd.h>
+#elif __has_include(<sys/resource.h>)
+#include <sys/resource.h>
+#define LOX_HAS_RLIMIT 1
+#endif
+
+// Left when exhausted() says so, for the code between two checks and for unwinding.
+static constexpr size_t Reserve = 256 * 1024;
+
+#ifdef LOX_SWITCH_STACK
+
+// The stack being switched to, read by its entry function, which takes no arguments.
+static thread_local NativeStack* s_starting = nullptr;
+
+NativeStack::NativeStack(size_t size)
+{
+    const size_t page = sysconf(_SC_PAGESIZE);
+    m_size = (std::max(size, 2 * Reserve) + page - 1) / page * page;
+}
+
+NativeStack::~NativeStack()
+{
+    if (m_memory)
+        munmap(m_memory, m_mappedSize);
+}
+
+void NativeStack::map()
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+#ifdef MAP_STACK
+    flags |= MAP_STACK;
+#endif
+    const size_t page = sysconf(_SC_PAGESIZE);
+    // The page below the stack faults, in case anything runs past the reserve anyway.
+    const size_t mappedSize = m_size + page;
+    void* memory = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (memory == MAP_FAILED)
+        throw std::bad_alloc();
+    if (mprotect(memory, page, PROT_NONE) != 0)
+    {
+        munmap(memory, mappedSize);
+        throw std::bad_alloc();
+    }
+    m_memory = memory;
+    m_mappedSize = mappedSize;
+    m_limit = reinterpret_cast<uintptr_t>(m_memory) + page + Reserve;
+}
+
+void NativeStack::run(const std::function<void()>& function)
+{
+    if (m_running)
+        return function();
+    if (!m_memory)
+        map();
+
+    m_function = &function;
+    getcontext(&m_context);
+    m_context.uc_stack.ss_sp = static_cast<char*>(m_memory) + (m_mappedSize - m_size);
+    m_context.uc_stack.ss_size = m_size;
+    m_context.uc_link = &m_caller;
+    makecontext(&m_context, &NativeStack::entry, 0);
+
+    s_starting = this;
+    m_running = true;
+    swapcontext(&m_caller, &m_context);
+    m_running = false;
+    m_function = nullptr;
+
+    if (auto exception = std::exchange(m_exception, nullptr))
+        std::rethrow_exception(exception);
+}
+
+void NativeStack::entry()
+{
+    // Exceptions can't unwind past the start of the stack, they are passed back to run instead.
+    auto* stack = s_starting;
+    try
+    {
+        (*stack->m_function)();
+    }
+    catch (...)
+    {
+        stack->m_exception = std::current_exception();
+    }
+}
+
+#else
+
+// What the thread's stack is assumed to hold: the limit the main thread gets, which is also the
+// default for new threads with glibc and most other pthreads implementations.
+static size_t threadStackSize()
+{
+    size_t size = 1024 * 1024;
+#ifdef LOX_HAS_RLIMIT
+    rlimit limit;
+    if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+        size = limit.rlim_cur;
+#endif
+    return size;
+}
+
+NativeStack::NativeStack(size_t size) : m_size(std::max(size, 2 * Reserve))
+{
+}
+
+NativeStack::~NativeStack() = default;
+
+void NativeStack::run(const std::function<void()>& function)
+{
+    if (m_running)
+        return function();
+
+    // The stack grows down from here, by as much as it can hold less what ran before this.
+    const char marker = 0;
+    const size_t budget = std::min(m_size, threadStackSize() / 2);
+    m_limit = reinterpret_cast<uintptr_t>(&marker) - (budget - std::min(budget, Reserve));
+    m_running = true;
+    try
+    {
+        function();
+    }
+    catch (...)
+    {
+        m_running = false;
+        throw;
+    }
+    m_running = false;
+}
+
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <exception>
+
+// AddressSanitizer can't follow code onto a stack it didn't see allocated.
+#if defined(__SANITIZE_ADDRESS__)
+#define LOX_SANITIZE_ADDRESS 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define LOX_SANITIZE_ADDRESS 1
+#endif
+#endif
+
+// glibc has the ucontext functions without feature macros; other platforms run on the thread's stack.
+#if defined(__GLIBC__) && __has_include(<ucontext.h>) && __has_include(<sys/mman.h>) && !defined(LOX_SANITIZE_ADDRESS)
+#define LOX_SWITCH_STACK 1
+#include <ucontext.h>
+#endif
+
+// Memory for the call stack of either engine, unless the host sets a budget of its own.
+inline constexpr size_t DefaultStackSize = 256 * 1024 * 1024;
+
+// A native stack allocated on the heap, to run code that recurses deeper than the thread's own
+// stack allows. Its memory is reserved on the first run and only committed as the code grows into
+// it. Where stacks can't be switched, code runs on the thread's stack and exhausted() measures how
+// deep it went against the smaller of the size and what that stack is likely to hold.
+class NativeStack
+{
+public:
+    explicit NativeStack(size_t size);
+    NativeStack(const NativeStack&) = delete;
+    NativeStack& operator=(const NativeStack&) = delete;
+    ~NativeStack();
+
+    size_t size() const { return m_size; }
+
+    // Runs the function on this stack and returns when it does, rethrowing what it threw. Called
+    // from code already running on it, just calls it.
+    void run(const std::function<void()>& function);
+
+    // Whether the code running on this stack has come close enough to its end to stop recursing,
+    // with room left to throw and unwind.
+    bool exhausted() const
+    {
+        const char marker = 0;
+        return m_running && reinterpret_cast<uintptr_t>(&marker) < m_limit;
+    }
+
+private:
+    size_t m_size;
+    uintptr_t m_limit = 0;
+    bool m_running = false;
+#ifdef LOX_SWITCH_STACK
+    static void entry();
+    void map();
+
+    size_t m_mappedSize = 0;
+    void* m_memory = nullptr;
+    ucontext_t m_context;
+    ucontext_t m_caller;
+    const std::function<void()>* m_function = nullptr;
+    std::exception_ptr m_exception;
+#endif
+};
@@ -0,0 +1,26 @@
+#include "pch.hpp"
+
+#include "stats.hpp"
+
+void Stats::print() const
+{
+    const auto ms = [](Duration duration) { return duration.count() * 1000; };
+    fmt::println(stderr,
+                 "[stats] scan {:.3f} ms, parse {:.3f} ms, resolve {:.3f} ms, compile {:.3f} ms, cache load {:.3f} ms, "
+                 "execute {:.3f} ms",
+                 ms(scan),
+                 ms(parse),
+                 ms(resolve),
+                 ms(compile),
+                 ms(cacheLoad),
+                 ms(execute));
+    fmt::println(stderr, "[stats] {} tokens, {} AST nodes", tokens, nodes);
+    fmt::println(stderr,
+                 "[stats] {} calls, {} environments, {} instances, {} method binds, {} string concatenations",
+                 calls,
+                 environments,
+                 instances,
+                 methodBinds,
+                 concatenations);
+    fmt::println(stderr, "[stats] peak call depth {}", peakDepth);
+}
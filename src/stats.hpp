@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+// What --stats reports: the time spent in each phase of a run and how much work the engines did.
+// Phases are timed once per run either way; the engines only count their work while counting is
+// on, so calls and allocations don't pay for counters nobody prints. Every interpreter keeps its own.
+struct Stats
+{
+    using Duration = std::chrono::duration<double>;
+
+    void print() const;
+
+    // Accumulated over every script run by the interpreter.
+    Duration scan{};
+    Duration parse{};
+    Duration resolve{};
+    Duration compile{};
+    // Reading bytecode from the cache instead of the four phases above.
+    Duration cacheLoad{};
+    Duration execute{};
+
+    size_t tokens = 0;
+    size_t nodes = 0;
+
+    // Set by --stats before running anything.
+    bool counting = false;
+    size_t calls = 0;
+    size_t environments = 0;
+    size_t instances = 0;
+    size_t methodBinds = 0;
+    size_t concatenations = 0;
+    // Deepest nesting of Lox calls, the script itself is not counted.
+    int peakDepth = 0;
+
+    // Counts a call to a Lox function, which runs `depth` calls deep.
+    void enterCall(int depth)
+    {
+        calls++;
+        if (depth > peakDepth)
+            peakDepth = depth;
+    }
+};
+
+// Adds the time until it goes out of scope to a phase.
+class PhaseTimer
+{
+public:
+    explicit PhaseTimer(Stats::Duration& phase) : m_phase(phase), m_start(std::chrono::steady_clock::now()) {}
+    ~PhaseTimer() { m_phase += std::chrono::steady_clock::now() - m_start; }
+
+private:
+    Stats::Duration& m_phase;
+    std::chrono::steady_clock::time_point m_start;
+};
@@ -17,127 +17,170 @@ public:
     class Return;
     class Class;
 
-    virtual ~Stmt() = default;
+    enum class Kind
+    {
+        Expression,
+        Print,
+        Var,
+        Block,
+        If,
+        While,
+        For,
+        Fun,
+        Return,
+        Class,
+    };
+
+    explicit Stmt(Kind kind) : kind(kind) {}
+    Stmt(const Stmt&) = delete;
+    Stmt& operator=(const Stmt&) = delete;
+
+    const Kind kind;
+    // Line the statement starts on, set by the parser.
+    int line = 0;
 };
 
 class Stmt::Expression : public Stmt
 {
 public:
-    Expression(std::unique_ptr<Expr> expression) : expression(std::move(expression)) { assert(this->expression); }
+    Expression(Expr* expression) : Stmt(Kind::Expression), expression(expression)
+    {
+        assert(this->expression);
+    }
 
-    std::unique_ptr<Expr> expression;
+    Expr* expression;
 };
 
 class Stmt::Print : public Stmt
 {
 public:
-    Print(std::unique_ptr<Expr> expression) : expression(std::move(expression)) { assert(this->expression); }
+    Print(Expr* expression) : Stmt(Kind::Print), expression(expression)
+    {
+        assert(this->expression);
+    }
 
-    std::unique_ptr<Expr> expression;
+    Expr* expression;
 };
 
 class Stmt::Var : public Stmt
 {
 public:
-    Var(const Token& name) : name(name) {}
-    Var(const Token& name, std::unique_ptr<Expr> expression) : name(name), expression(std::move(expression)) {}
+    Var(const Token& name, LoxString* symbol, Expr* expression = nullptr)
+        : Stmt(Kind::Var), name(name), symbol(symbol), expression(expression)
+    {
+    }
 
-    Token name;
-    std::unique_ptr<Expr> expression;
+    const Token& name;
+    LoxString* symbol;
+    Expr* expression = nullptr;
+    // Filled in by the resolver: a slot in the current environment (depth 0) or frame, or global.
+    mutable VarSlot slot;
 };
 
 class Stmt::Block : public Stmt
 {
 public:
-    Block() = default;
-    Block(std::vector<std::unique_ptr<Stmt>>&& statements) : statements(std::move(statements)) {}
-
-    std::vector<std::unique_ptr<Stmt>> statements;
+    Block() : Stmt(Kind::Block) {}
+    Block(NodeList<Stmt> statements) : Stmt(Kind::Block), statements(statements) {}
+
+    NodeList<Stmt> statements;
+    // Number of locals declared directly in the block, filled in by the resolver.
+    mutable int slotCount = 0;
+    // Whether the locals are in the frame of the function the block is in, which then needs no environment.
+    mutable bool usesFrame = false;
 };
 
 class Stmt::If : public Stmt
 {
 public:
-    If(std::unique_ptr<Expr> condition, std::unique_ptr<Stmt> ifBranch, std::unique_ptr<Stmt> elseBranch = nullptr)
-        : condition(std::move(condition)), ifBranch(std::move(ifBranch)), elseBranch(std::move(elseBranch))
+    If(Expr* condition, Stmt* ifBranch, Stmt* elseBranch = nullptr)
+        : Stmt(Kind::If), condition(condition), ifBranch(ifBranch), elseBranch(elseBranch)
     {
         assert(this->condition);
         assert(this->ifBranch);
     }
 
-    std::unique_ptr<Expr> condition;
-    std::unique_ptr<Stmt> ifBranch;
-    std::unique_ptr<Stmt> elseBranch;
+    Expr* condition;
+    Stmt* ifBranch;
+    Stmt* elseBranch;
 };
 
 class Stmt::While : public Stmt
 {
 public:
-    While(std::unique_ptr<Expr> condition, std::unique_ptr<Stmt> body)
-        : condition(std::move(condition)), body(std::move(body))
+    While(Expr* condition, Stmt* body) : Stmt(Kind::While), condition(condition), body(body)
     {
         assert(this->condition);
         assert(this->body);
     }
 
-    std::unique_ptr<Expr> condition;
-    std::unique_ptr<Stmt> body;
+    Expr* condition;
+    Stmt* body;
 };
 
 class Stmt::For : public Stmt
 {
 public:
-    For(std::unique_ptr<Stmt> initializer,
-        std::unique_ptr<Expr> condition,
-        std::unique_ptr<Expr> step,
-        std::unique_ptr<Stmt> body)
-        : initializer(std::move(initializer)),
-          condition(std::move(condition)),
-          step(std::move(step)),
-          body(std::move(body))
+    For(Stmt* initializer, Expr* condition, Expr* step, Stmt* body)
+        : Stmt(Kind::For), initializer(initializer), condition(condition), step(step), body(body)
     {
         assert(this->body);
     }
 
-    std::unique_ptr<Stmt> initializer;
-    std::unique_ptr<Expr> condition;
-    std::unique_ptr<Expr> step;
+    Stmt* initializer;
+    Expr* condition;
+    Expr* step;
 
-    std::unique_ptr<Stmt> body;
+    Stmt* body;
 };
 
 class Stmt::Fun : public Stmt
 {
 public:
-    Fun(const Token& name, std::vector<Token> params, std::vector<std::unique_ptr<Stmt>> body)
-        : name(name), params(std::move(params)), body(std::move(body))
+    Fun(const Token& name, LoxString* symbol, NodeList<const Token> params, NodeList<Stmt> body)
+        : Stmt(Kind::Fun), name(name), symbol(symbol), params(params), body(body)
     {
     }
 
-    Token name;
-    std::vector<Token> params;
-    std::vector<std::unique_ptr<Stmt>> body;
+    const Token& name;
+    LoxString* symbol;
+    NodeList<const Token> params;
+    NodeList<Stmt> body;
+    // Filled in by the resolver: the slot of the function's name (-1 for globals and methods)
+    // and the number of locals in its body: the receiver or the function itself, the parameters
+    // and the rest. With usesFrame, they are in a frame on the interpreter's stack instead of an
+    // environment, and slotCount is the size of the frame.
+    mutable int slot = -1;
+    mutable int slotCount = 0;
+    mutable bool usesFrame = false;
 };
 
 class Stmt::Return : public Stmt
 {
 public:
-    Return(const Token& keyword, std::unique_ptr<Expr> value = nullptr) : keyword(keyword), value(std::move(value))
+    Return(const Token& keyword, Expr* value = nullptr) : Stmt(Kind::Return), keyword(keyword), value(value)
     {
         assert(keyword.type == TokenType::Return);
     }
 
-    Token keyword;
-    std::unique_ptr<Expr> value;
+    const Token& keyword;
+    Expr* value;
+    // The call the value is, if it's one and returned from a function, set by the resolver. The
+    // engines run it in place of the returning function instead of nested in it.
+    mutable const Expr::Call* tailCall = nullptr;
 };
 
 class Stmt::Class : public Stmt
 {
 public:
-    Class(const Token& name, std::vector<std::unique_ptr<Stmt::Fun>> methods) : name(name), methods(std::move(methods))
+    Class(const Token& name, LoxString* symbol, NodeList<Stmt::Fun> methods)
+        : Stmt(Kind::Class), name(name), symbol(symbol), methods(methods)
     {
     }
 
-    Token name;
-    std::vector<std::unique_ptr<Stmt::Fun>> methods;
+    const Token& name;
+    LoxString* symbol;
+    NodeList<Stmt::Fun> methods;
+    // Slot in the current environment, filled in by the resolver. -1 for globals.
+    mutable int slot = -1;
 };
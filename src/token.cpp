@@ -10,6 +10,8 @@ static auto tokenTypeStrings = std::to_array({
     "RightParen",
     "LeftBrace",
     "RightBrace",
+    "LeftBracket",
+    "RightBracket",
     "Comma",
     "Dot",
     "Minus",
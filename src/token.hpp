@@ -1,5 +1,7 @@
 #pragma once
 
+#include <iosfwd>
+
 enum class TokenType
 {
     // Single-character tokens
@@ -7,6 +9,8 @@ enum class TokenType
     RightParen,
     LeftBrace,
     RightBrace,
+    LeftBracket,
+    RightBracket,
     Comma,
     Dot,
     Minus,
@@ -52,13 +56,14 @@ enum class TokenType
     Eof
 };
 
+// The lexeme is a view into the scanned source, which the Ast keeps alive along with its tokens.
 struct Token
 {
     TokenType type;
-    std::string lexeme;
     int line;
+    std::string_view lexeme;
 
-    Token(TokenType type, const std::string& lexeme, int line) : type(type), lexeme(lexeme), line(line) {}
+    Token(TokenType type, std::string_view lexeme, int line) : type(type), line(line), lexeme(lexeme) {}
 };
 
 std::ostream& operator<<(std::ostream& os, TokenType type);
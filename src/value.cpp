@@ -1,74 +1,119 @@
-#include "error.hpp"
 #include "pch.hpp"
 
-#include "environment.hpp"
-#include "interpreter.hpp"
+#include "heap.hpp"
 #include "value.hpp"
 
-LoxFunction::LoxFunction(const Stmt::Fun& declaration, std::shared_ptr<Environment> closure)
-    : declaration(declaration), closure(closure)
+LoxClass::LoxClass(std::string_view name, StringMap<ICallable*> methods)
+    : ICallable(Kind::Class), name(name), methods(std::move(methods)), shape(Heap::get().make<Shape>())
 {
 }
 
-Value LoxFunction::call(Interpreter& interpreter, const std::vector<Value>& arguments)
+int LoxClass::arity() const
 {
-    auto env = std::make_shared<Environment>(closure);
-
-    for (int i = 0; i < arguments.size(); i++)
-    {
-        env->define(declaration.params[i].lexeme, arguments[i]);
-    }
+    return 0;
+}
 
-    try
-    {
-        interpreter.executeBlock(declaration.body, env);
-    }
-    catch (const Return& returnValue)
+void LoxClass::trace(Heap& heap) const
+{
+    for (const auto& [name, method] : methods)
     {
-        return returnValue.value;
+        heap.mark(name);
+        heap.mark(method);
     }
-
-    return Value();
+    heap.mark(shape);
 }
 
-LoxFunction LoxFunction::bind(const Value& instance) const
+std::string LoxInstance::toString() const
 {
-    auto env = std::make_shared<Environment>(closure);
-    env->define("this", instance);
-    return LoxFunction(declaration, env);
+    return fmt::format("<{} instance>", clazz->name);
 }
 
-int LoxClass::arity() const
+void LoxInstance::trace(Heap& heap) const
 {
-    return 0;
+    heap.mark(clazz);
+    heap.mark(shape);
+    for (const auto& value : fields)
+        heap.mark(value);
 }
 
-Value LoxClass::call(Interpreter& interpreter, const std::vector<Value>& arguments)
+Property LoxInstance::lookupProperty(const LoxString* name, PropertyCache& cache) const
 {
-    return Value(std::make_shared<LoxInstance>(*this));
+    PropertyCache::Entry entry{shape};
+    if (int slot = shape->find(name); slot >= 0)
+        entry.property.slot = slot;
+    else if (auto it = clazz->methods.find(name); it != clazz->methods.end())
+        entry.property.method = it->second;
+    else
+        return {};
+
+    const auto property = entry.property;
+    cache.add(std::move(entry));
+    return property;
 }
 
-std::string LoxInstance::toString() const
+void LoxInstance::storeField(const LoxString* name, const Value& value, PropertyCache& cache)
 {
-    return fmt::format("<{} instance>", clazz.name);
+    PropertyCache::Entry entry{shape};
+    if (int slot = shape->find(name); slot >= 0)
+    {
+        entry.property.slot = slot;
+        fields[slot] = value;
+    }
+    else
+    {
+        entry.property.slot = fields.size();
+        entry.transition = shape->withField(name);
+        shape = entry.transition;
+        fields.push_back(value);
+    }
+    cache.add(std::move(entry));
 }
 
-Value LoxInstance::get(const Token& name) const
+ValueType Value::getType() const
 {
-    if (auto it = fields.find(name.lexeme); it != fields.end())
-        return it->second;
-
-    if (auto it = clazz.methods.find(name.lexeme); it != clazz.methods.end())
+    if (isNumber())
+        return ValueType::Number;
+    if (isNil())
+        return ValueType::Nil;
+    if (isBoolean())
+        return ValueType::Boolean;
+
+    switch (getObject()->type)
     {
-        return Value(it->second);
+    case Obj::Type::String:
+        return ValueType::String;
+    case Obj::Type::Callable:
+        return ValueType::Callable;
+    case Obj::Type::Instance:
+        return ValueType::Instance;
+    case Obj::Type::Array:
+        return ValueType::Array;
+    case Obj::Type::Environment:
+    case Obj::Type::Upvalue:
+    case Obj::Type::Shape:
+        break;
     }
 
-    throw RuntimeError(name, fmt::format("Undefined property '{}'", name.lexeme));
+    assert(0 && "unreachable");
+    return ValueType::Nil;
 }
 
-void LoxInstance::set(const Token& name, const Value& value)
+bool isTruthy(const Value& value)
 {
-    fields[name.lexeme] = value;
+    if (value.isNil())
+        return false;
+    if (value.isBoolean())
+        return value.getBoolean();
+    return true;
+}
+
+bool isEqual(const Value& left, const Value& right)
+{
+    if (left.isNumber() && right.isNumber())
+        return left.getNumber() == right.getNumber();
+
+    // Strings are interned and everything else compares by identity, so the bits decide.
+    return left.m_bits == right.m_bits;
 }
 
 std::string format_as(const Value& value)
@@ -85,6 +130,8 @@ std::string format_as(const Value& value)
         return value.getCallable()->toString();
     if (value.isInstance())
         return value.getInstance()->toString();
+    if (value.isArray())
+        return value.getArray()->toString();
 
     assert(0 && "unreachable");
     return "";
@@ -1,9 +1,11 @@
 #pragma once
 
-#include "stmt.hpp"
+#include "object.hpp"
+#include "shape.hpp"
 
-#include <unordered_map>
-#include <variant>
+#include <bit>
+#include <cmath>
+#include <optional>
 
 enum class ValueType
 {
@@ -12,108 +14,273 @@ enum class ValueType
     Number,
     String,
     Callable,
+    Instance,
+    Array,
 };
 
-class Interpreter;
 class Value;
-class Environment;
 class LoxInstance;
 
-class ICallable
+class ICallable : public Obj
 {
 public:
-    virtual ~ICallable() = default;
-    virtual Value call(Interpreter& interpreter, const std::vector<Value>& arguments) = 0;
+    enum class Kind
+    {
+        Function,
+        Class,
+        Native,
+        Closure,
+        BoundMethod,
+    };
+
+    explicit ICallable(Kind kind) : Obj(Type::Callable), kind(kind) {}
     virtual std::string toString() const = 0;
     virtual int arity() const = 0;
+
+    const Kind kind;
 };
 
-class LoxFunction : public ICallable
+class LoxClass : public ICallable
 {
 public:
-    LoxFunction(const Stmt::Fun& declaration, std::shared_ptr<Environment> closure);
+    LoxClass(std::string_view name, StringMap<ICallable*> methods = {});
 
-    std::string toString() const override { return fmt::format("<fun {}>", declaration.name.lexeme); }
-    int arity() const override { return declaration.params.size(); }
-    Value call(Interpreter& interpreter, const std::vector<Value>& arguments) override;
-    LoxFunction bind(const Value& instance) const;
+    std::string toString() const override { return fmt::format("<class {}>", name); }
+    int arity() const override;
+    void trace(Heap& heap) const override;
 
-    const Stmt::Fun& declaration;
-    std::shared_ptr<Environment> closure;
+public:
+    std::string name;
+    // LoxFunctions when created by the interpreter, VmClosures when created by the VM.
+    StringMap<ICallable*> methods;
+    // The shape of new instances, which have no fields yet.
+    Shape* shape;
 };
 
-class LoxClass : public ICallable
+class NativeFunction : public ICallable
 {
 public:
-    LoxClass(const std::string& name, std::unordered_map<std::string, std::shared_ptr<LoxFunction>> methods)
-        : name(name), methods(std::move(methods))
+    NativeFunction() : ICallable(Kind::Native) {}
+
+    std::string toString() const override { return "<native func>"; }
+    virtual Value call(std::span<const Value> arguments) = 0;
+};
+
+class LoxInstance : public Obj
+{
+public:
+    LoxInstance(LoxClass* clazz) : Obj(Type::Instance), clazz(clazz), shape(clazz->shape) {}
+
+    std::string toString() const;
+    void trace(Heap& heap) const override;
+
+    // Looks a property up through the inline cache of the access site: a field, or else a method.
+    Property getProperty(const LoxString* name, PropertyCache& cache) const
     {
+        if (const auto* entry = cache.find(shape))
+            return entry->property;
+        return lookupProperty(name, cache);
     }
 
-    std::string toString() const override { return fmt::format("<class {}>", name); }
-    int arity() const override;
-    Value call(Interpreter& interpreter, const std::vector<Value>& arguments) override;
+    // Stores a field through the inline cache of the access site, adding it if it's new.
+    void setField(const LoxString* name, const Value& value, PropertyCache& cache);
 
-public:
-    std::string name;
-    const std::unordered_map<std::string, std::shared_ptr<LoxFunction>> methods;
+    LoxClass* clazz;
+    Shape* shape;
+    // Indexed by the slots of the shape.
+    std::vector<Value> fields;
+
+private:
+    Property lookupProperty(const LoxString* name, PropertyCache& cache) const;
+    void storeField(const LoxString* name, const Value& value, PropertyCache& cache);
 };
 
-class LoxInstance
+// A growable array. While it holds nothing but numbers they are kept unboxed in a contiguous
+// buffer of doubles, which the bulk operations run over with SIMD. Storing anything else boxes them
+// into values. Once every element is a number again, the bulk operations unbox them first.
+class LoxArray : public Obj
 {
 public:
-    LoxInstance(LoxClass& clazz) : clazz(clazz) {}
+    explicit LoxArray(std::span<const Value> elements);
+
+    size_t size() const { return m_numeric ? m_numbers.size() : m_values.size(); }
+    bool isNumeric() const { return m_numeric; }
+    // Whether every element is a number, unboxing them if they are boxed.
+    bool makeNumeric();
+    // The elements of a numeric array.
+    std::span<double> numbers() { return m_numbers; }
+
+    // The element a number indexes, empty unless it is a whole number within the array.
+    std::optional<size_t> element(double index) const
+    {
+        if (!(index >= 0 && index < static_cast<double>(size())) || index != std::floor(index))
+            return std::nullopt;
+        return static_cast<size_t>(index);
+    }
+
+    Value at(size_t index) const;
+    void set(size_t index, const Value& value);
+    void push(const Value& value);
+    void fill(const Value& value);
+
+    // Bulk operations on numeric arrays.
+    double sum() const;
+    double dot(const LoxArray& other) const;
+    void scale(double factor);
 
     std::string toString() const;
-    Value get(const Token& name) const;
-    void set(const Token& name, const Value& value);
+    void trace(Heap& heap) const override;
+    size_t ownedBytes() const override { return bufferBytes(); }
 
-    LoxClass& clazz;
+private:
+    void box();
+    size_t bufferBytes() const;
+    // Reports the buffers growing or shrinking to the heap after they were reallocated.
+    void recount()
+    {
+        if (bufferBytes() != m_countedBytes)
+            resized();
+    }
+    void resized();
 
-    std::unordered_map<std::string, Value> fields;
+    bool m_numeric = true;
+    std::vector<double> m_numbers;
+    std::vector<Value> m_values;
+    // The elements of m_values that aren't numbers.
+    size_t m_nonNumbers = 0;
+    // The size of the buffers the heap counts.
+    size_t m_countedBytes = 0;
+    // Set while the array is converted to a string, so one containing itself prints as [...].
+    mutable bool m_printing = false;
 };
 
+// A NaN-boxed value. Numbers are stored as plain doubles. Everything else lives in the
+// payload of a quiet NaN: nil and booleans as immediates, objects as a pointer with the
+// sign bit set. Objects are owned by the Heap, so copying a Value is copying its bits.
 class Value
 {
 public:
-    using Nil = std::monostate;
     using Boolean = bool;
     using Number = double;
     using String = std::string;
-    using Callable = std::shared_ptr<ICallable>;
-    using Instance = std::shared_ptr<LoxInstance>;
-
-    explicit Value() : m_variant(Nil{}) {}
-    explicit Value(bool value) : m_variant(Boolean{value}) {}
-    explicit Value(double value) : m_variant(Number{value}) {}
-    explicit Value(const std::string& value) : m_variant(String{value}) {}
-    explicit Value(const Callable& value) : m_variant(Callable{value}) {}
-    explicit Value(const Instance& value) : m_variant(Instance{value}) {}
-
-    ValueType getType() const { return static_cast<ValueType>(m_variant.index()); }
-
-    bool isNil() const { return std::holds_alternative<Nil>(m_variant); }
-    bool isBoolean() const { return std::holds_alternative<Boolean>(m_variant); }
-    bool isNumber() const { return std::holds_alternative<Number>(m_variant); }
-    bool isString() const { return std::holds_alternative<String>(m_variant); }
-    bool isCallable() const { return std::holds_alternative<Callable>(m_variant); }
-    bool isInstance() const { return std::holds_alternative<Instance>(m_variant); }
-
-    void setNil() { m_variant = Nil{}; }
-    void setBoolean(const Boolean& boolean) { m_variant = boolean; }
-    void setNumber(const Number& number) { m_variant = number; }
-    void setString(const String& string) { m_variant = string; }
-    void setCallable(const Callable& callable) { m_variant = callable; }
-    void setInstance(const Instance& instance) { m_variant = instance; }
-
-    Boolean getBoolean() const { return std::get<Boolean>(m_variant); }
-    Number getNumber() const { return std::get<Number>(m_variant); }
-    String getString() const { return std::get<String>(m_variant); }
-    Callable getCallable() const { return std::get<Callable>(m_variant); }
-    Instance getInstance() const { return std::get<Instance>(m_variant); }
+    using Callable = ICallable*;
+    using Instance = LoxInstance*;
+    using Array = LoxArray*;
+
+    explicit Value() : m_bits(NilBits) {}
+    explicit Value(bool value) : m_bits(value ? TrueBits : FalseBits) {}
+    explicit Value(double value) : m_bits(std::bit_cast<uint64_t>(value)) {}
+    explicit Value(const std::string& value) : Value(LoxString::intern(value)) {}
+    explicit Value(std::string&& value) : Value(LoxString::intern(std::move(value))) {}
+    explicit Value(LoxString* value) : Value(static_cast<Obj*>(value)) {}
+    explicit Value(ICallable* value) : Value(static_cast<Obj*>(value)) {}
+    explicit Value(LoxInstance* value) : Value(static_cast<Obj*>(value)) {}
+    explicit Value(LoxArray* value) : Value(static_cast<Obj*>(value)) {}
+
+    ValueType getType() const;
+
+    bool isNil() const { return m_bits == NilBits; }
+    bool isBoolean() const { return (m_bits | 1) == TrueBits; }
+    bool isNumber() const { return (m_bits & QuietNaN) != QuietNaN; }
+    bool isString() const { return isObjectOf(Obj::Type::String); }
+    bool isCallable() const { return isObjectOf(Obj::Type::Callable); }
+    bool isInstance() const { return isObjectOf(Obj::Type::Instance); }
+    bool isArray() const { return isObjectOf(Obj::Type::Array); }
+    bool isObject() const { return (m_bits & ObjectBits) == ObjectBits; }
+
+    void setNil() { *this = Value(); }
+    void setBoolean(const Boolean& boolean) { *this = Value(boolean); }
+    void setNumber(const Number& number) { *this = Value(number); }
+    void setString(const String& string) { *this = Value(string); }
+    void setCallable(const Callable& callable) { *this = Value(callable); }
+    void setInstance(const Instance& instance) { *this = Value(instance); }
+
+    Boolean getBoolean() const { return m_bits == TrueBits; }
+    Number getNumber() const { return std::bit_cast<double>(m_bits); }
+    const String& getString() const { return static_cast<LoxString*>(getObject())->chars; }
+    Callable getCallable() const { return static_cast<ICallable*>(getObject()); }
+    Instance getInstance() const { return static_cast<LoxInstance*>(getObject()); }
+    Array getArray() const { return static_cast<LoxArray*>(getObject()); }
+    Obj* getObject() const { return reinterpret_cast<Obj*>(m_bits & ~ObjectBits); }
 
 private:
-    std::variant<Nil, Boolean, Number, String, Callable, Instance> m_variant = Nil{};
+    static constexpr uint64_t SignBit = 0x8000'0000'0000'0000;
+    static constexpr uint64_t QuietNaN = 0x7ffc'0000'0000'0000;
+    static constexpr uint64_t NilBits = QuietNaN | 1;
+    static constexpr uint64_t FalseBits = QuietNaN | 2;
+    static constexpr uint64_t TrueBits = QuietNaN | 3;
+    static constexpr uint64_t ObjectBits = SignBit | QuietNaN;
+
+    explicit Value(Obj* object) : m_bits(ObjectBits | reinterpret_cast<uintptr_t>(object)) {}
+
+    bool isObjectOf(Obj::Type type) const { return isObject() && getObject()->type == type; }
+
+    uint64_t m_bits;
+
+    friend bool isEqual(const Value& left, const Value& right);
 };
 
+static_assert(sizeof(Value) == sizeof(double));
+static_assert(std::is_trivially_copyable_v<Value>);
+
+inline void LoxInstance::setField(const LoxString* name, const Value& value, PropertyCache& cache)
+{
+    const auto* entry = cache.find(shape);
+    if (!entry)
+    {
+        storeField(name, value, cache);
+        return;
+    }
+
+    if (entry->transition)
+    {
+        shape = entry->transition;
+        fields.push_back(value);
+    }
+    else
+    {
+        fields[entry->property.slot] = value;
+    }
+}
+
+inline size_t LoxArray::bufferBytes() const
+{
+    return m_numbers.capacity() * sizeof(double) + m_values.capacity() * sizeof(Value);
+}
+
+inline Value LoxArray::at(size_t index) const
+{
+    return m_numeric ? Value(m_numbers[index]) : m_values[index];
+}
+
+inline void LoxArray::set(size_t index, const Value& value)
+{
+    if (m_numeric && value.isNumber())
+    {
+        m_numbers[index] = value.getNumber();
+        return;
+    }
+    box();
+    m_nonNumbers = m_nonNumbers - !m_values[index].isNumber() + !value.isNumber();
+    m_values[index] = value;
+}
+
+inline void LoxArray::push(const Value& value)
+{
+    if (m_numeric && value.isNumber())
+    {
+        m_numbers.push_back(value.getNumber());
+    }
+    else
+    {
+        box();
+        m_nonNumbers += !value.isNumber();
+        m_values.push_back(value);
+    }
+    recount();
+}
+
+bool isTruthy(const Value& value);
+bool isEqual(const Value& left, const Value& right);
+
 std::string format_as(const Value& value);
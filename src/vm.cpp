@@ -0,0 +1,667 @@
+#include "pch.hpp"
+
+#include "vm.hpp"
+
+#include "error.hpp"
+#include "native.hpp"
+
+std::string VmClosure::toString() const
+{
+    return fmt::format("<fun {}>", function->name);
+}
+
+void VmClosure::trace(Heap& heap) const
+{
+    for (const auto* upvalue : upvalues)
+        heap.mark(upvalue);
+}
+
+void VmBoundMethod::trace(Heap& heap) const
+{
+    heap.mark(receiver);
+    heap.mark(method);
+}
+
+VM::VM(Heap& heap, Stats& stats) : m_heap(heap), m_stats(stats), m_stack(InitialSlots), m_stackTop(m_stack.data()),
+      m_frames(InitialFrames)
+{
+    defineGlobal("clock", Value(m_heap.make<Clock>()));
+    defineArrayNatives(m_heap, [this](std::string_view name, const Value& value) { defineGlobal(name, value); });
+    m_heap.addRoots(this);
+}
+
+VM::~VM()
+{
+    m_heap.removeRoots(this);
+}
+
+void VM::markRoots(Heap& heap) const
+{
+    for (const Value* slot = m_stack.data(); slot < m_stackTop; slot++)
+        heap.mark(*slot);
+    for (int i = 0; i < m_frameCount; i++)
+        heap.mark(m_frames[i].closure);
+    for (const auto* upvalue : m_openUpvalues)
+        heap.mark(upvalue);
+    for (const auto& global : m_globals)
+        heap.mark(global.value);
+}
+
+int VM::globalSlot(std::string_view name)
+{
+    auto [it, inserted] = m_globalSlots.try_emplace(std::string(name), m_globals.size());
+    if (inserted)
+    {
+        m_globals.emplace_back();
+        m_globalNames.emplace_back(name);
+    }
+    return it->second;
+}
+
+void VM::defineGlobal(std::string_view name, const Value& value)
+{
+    auto& global = m_globals[globalSlot(name)];
+    global.value = value;
+    global.defined = true;
+}
+
+void VM::interpret(std::shared_ptr<VmFunction> script)
+{
+    auto* closure = m_heap.make<VmClosure>(std::move(script));
+    push(Value(closure));
+    // Not through callClosure, the script is not counted as a call.
+    m_frames[m_frameCount++] = {closure, closure->function->chunk.code.data(), m_stackTop - 1};
+
+    try
+    {
+        run();
+    }
+    catch (const RuntimeError&)
+    {
+        reset();
+        throw;
+    }
+}
+
+Value VM::call(const Value& callee, std::span<const Value> arguments)
+{
+    // Only one call runs at a time, a native can't call back into Lox.
+    assert(m_frameCount == 0);
+    push(callee);
+    for (const auto& argument : arguments)
+        push(argument);
+
+    try
+    {
+        callValue(callee, arguments.size());
+        // Classes and natives return without pushing a frame.
+        if (m_frameCount == 0)
+        {
+            Value result = pop();
+            reset();
+            return result;
+        }
+        return run();
+    }
+    catch (...)
+    {
+        reset();
+        throw;
+    }
+}
+
+std::optional<Value> VM::global(std::string_view name) const
+{
+    if (auto it = m_globalSlots.find(std::string(name)); it != m_globalSlots.end() && m_globals[it->second].defined)
+        return m_globals[it->second].value;
+    return std::nullopt;
+}
+
+Value VM::run()
+{
+    CallFrame* frame = &m_frames[m_frameCount - 1];
+    const uint8_t* ip = frame->ip;
+
+    auto readByte = [&]() { return *ip++; };
+    auto readShort = [&]()
+    {
+        ip += 2;
+        return static_cast<uint16_t>(ip[-2] << 8 | ip[-1]);
+    };
+    auto chunk = [&]() -> const Chunk& { return frame->closure->function->chunk; };
+    // Reports an error at the instruction byte `back` bytes behind ip.
+    auto error = [&](int back, const std::string& message)
+    {
+        frame->ip = ip;
+        throw RuntimeError(chunk().tokenAt(ip - back - chunk().code.data()), message);
+    };
+    auto checkNumbers = [&]()
+    {
+        if (!peek(0).isNumber() || !peek(1).isNumber())
+            error(1, "Operands must be numbers.");
+    };
+    auto popNumber = [&]() { return (--m_stackTop)->getNumber(); };
+    // The array and the element of it an index refers to, for GetIndex and SetIndex.
+    auto checkElement = [&](const Value& object, const Value& index) -> std::pair<LoxArray*, size_t>
+    {
+        if (!object.isArray())
+            error(1, "Only arrays can be indexed.");
+        if (!index.isNumber())
+            error(1, "Array index must be a number.");
+        auto* array = object.getArray();
+        const auto element = array->element(index.getNumber());
+        if (!element)
+            error(1, "Array index out of range.");
+        return {array, *element};
+    };
+
+    while (true)
+    {
+        switch (static_cast<OpCode>(readByte()))
+        {
+        case OpCode::Constant:
+            push(chunk().constants[readShort()]);
+            break;
+        case OpCode::Nil:
+            push(Value());
+            break;
+        case OpCode::True:
+            push(Value(true));
+            break;
+        case OpCode::False:
+            push(Value(false));
+            break;
+        case OpCode::Pop:
+            pop();
+            break;
+        case OpCode::GetLocal:
+            push(frame->slots[readByte()]);
+            break;
+        case OpCode::SetLocal:
+            frame->slots[readByte()] = peek(0);
+            break;
+        case OpCode::GetGlobal:
+        {
+            const int slot = readShort();
+            const auto& global = m_globals[slot];
+            if (!global.defined)
+                error(3, fmt::format("Undefined variable '{}'", m_globalNames[slot]));
+            push(global.value);
+            break;
+        }
+        case OpCode::DefineGlobal:
+        {
+            auto& global = m_globals[readShort()];
+            global.value = pop();
+            global.defined = true;
+            break;
+        }
+        case OpCode::SetGlobal:
+        {
+            const int slot = readShort();
+            auto& global = m_globals[slot];
+            if (!global.defined)
+                error(3, fmt::format("Undefined variable '{}'", m_globalNames[slot]));
+            global.value = peek(0);
+            break;
+        }
+        case OpCode::GetUpvalue:
+            push(*frame->closure->upvalues[readByte()]->location);
+            break;
+        case OpCode::SetUpvalue:
+            *frame->closure->upvalues[readByte()]->location = peek(0);
+            break;
+        case OpCode::GetProperty:
+        {
+            const auto* name = chunk().names[readShort()].get();
+            auto& cache = chunk().caches[readShort()];
+            if (!peek(0).isInstance())
+                error(5, "Only instances have properties");
+
+            const auto& instance = *peek(0).getInstance();
+            const auto property = instance.getProperty(name, cache);
+            if (property.isField())
+            {
+                peek(0) = instance.fields[property.slot];
+                break;
+            }
+
+            if (!property.isMethod())
+                error(5, fmt::format("Undefined property '{}'", name->chars));
+
+            if (m_stats.counting)
+                m_stats.methodBinds++;
+            Value method(m_heap.make<VmBoundMethod>(peek(0), static_cast<VmClosure*>(property.method)));
+            peek(0) = method;
+            break;
+        }
+        case OpCode::SetProperty:
+        {
+            const auto* name = chunk().names[readShort()].get();
+            auto& cache = chunk().caches[readShort()];
+            if (!peek(1).isInstance())
+                error(5, "Only instances have fields.");
+
+            peek(1).getInstance()->setField(name, peek(0), cache);
+            Value value = pop();
+            peek(0) = std::move(value);
+            break;
+        }
+        case OpCode::GetIndex:
+        {
+            const auto [array, element] = checkElement(peek(1), peek(0));
+            pop();
+            peek(0) = array->at(element);
+            break;
+        }
+        case OpCode::SetIndex:
+        {
+            const auto [array, element] = checkElement(peek(2), peek(1));
+            array->set(element, peek(0));
+            Value value = pop();
+            pop();
+            peek(0) = value;
+            break;
+        }
+        case OpCode::Array:
+        {
+            const int count = readByte();
+            auto* array = m_heap.make<LoxArray>(std::span<const Value>(m_stackTop - count, count));
+            m_stackTop -= count;
+            push(Value(array));
+            break;
+        }
+        case OpCode::Equal:
+        {
+            const bool equal = isEqual(peek(1), peek(0));
+            pop();
+            peek(0) = Value(equal);
+            break;
+        }
+        case OpCode::NotEqual:
+        {
+            const bool equal = isEqual(peek(1), peek(0));
+            pop();
+            peek(0) = Value(!equal);
+            break;
+        }
+        case OpCode::Greater:
+        {
+            checkNumbers();
+            const double right = popNumber();
+            peek(0).setBoolean(peek(0).getNumber() > right);
+            break;
+        }
+        case OpCode::GreaterEqual:
+        {
+            checkNumbers();
+            const double right = popNumber();
+            peek(0).setBoolean(peek(0).getNumber() >= right);
+            break;
+        }
+        case OpCode::Less:
+        {
+            checkNumbers();
+            const double right = popNumber();
+            peek(0).setBoolean(peek(0).getNumber() < right);
+            break;
+        }
+        case OpCode::LessEqual:
+        {
+            checkNumbers();
+            const double right = popNumber();
+            peek(0).setBoolean(peek(0).getNumber() <= right);
+            break;
+        }
+        case OpCode::Add:
+        {
+            if (peek(0).isNumber() && peek(1).isNumber())
+            {
+                const double right = popNumber();
+                peek(0).setNumber(peek(0).getNumber() + right);
+            }
+            else if (peek(0).isString() && peek(1).isString())
+            {
+                if (m_stats.counting)
+                    m_stats.concatenations++;
+                Value result(peek(1).getString() + peek(0).getString());
+                pop();
+                peek(0) = std::move(result);
+            }
+            else
+            {
+                error(1, "Operands must be two numbers or two strings");
+            }
+            break;
+        }
+        case OpCode::Subtract:
+        {
+            checkNumbers();
+            const double right = popNumber();
+            peek(0).setNumber(peek(0).getNumber() - right);
+            break;
+        }
+        case OpCode::Multiply:
+        {
+            checkNumbers();
+            const double right = popNumber();
+            peek(0).setNumber(peek(0).getNumber() * right);
+            break;
+        }
+        case OpCode::Divide:
+        {
+            checkNumbers();
+            const double right = popNumber();
+            peek(0).setNumber(peek(0).getNumber() / right);
+            break;
+        }
+        case OpCode::Not:
+            peek(0) = Value(!isTruthy(peek(0)));
+            break;
+        case OpCode::Negate:
+            if (!peek(0).isNumber())
+                error(1, "Operand must be a number.");
+            peek(0).setNumber(-peek(0).getNumber());
+            break;
+        case OpCode::Print:
+            fmt::println(m_output, "{}", peek(0));
+            pop();
+            break;
+        case OpCode::Jump:
+        {
+            const uint16_t offset = readShort();
+            ip += offset;
+            break;
+        }
+        case OpCode::JumpIfFalse:
+        {
+            const uint16_t offset = readShort();
+            if (!isTruthy(peek(0)))
+                ip += offset;
+            break;
+        }
+        case OpCode::Loop:
+        {
+            // Loops and calls are the safepoints, everything in use is on the stack there.
+            m_heap.collectIfNeeded();
+            const uint16_t offset = readShort();
+            ip -= offset;
+            break;
+        }
+        case OpCode::Call:
+        {
+            m_heap.collectIfNeeded();
+            const int argCount = readByte();
+            frame->ip = ip;
+            callValue(peek(argCount), argCount);
+            frame = &m_frames[m_frameCount - 1];
+            ip = frame->ip;
+            break;
+        }
+        case OpCode::Invoke:
+        {
+            m_heap.collectIfNeeded();
+            const auto& name = chunk().names[readShort()];
+            auto& cache = chunk().caches[readShort()];
+            const int argCount = readByte();
+            frame->ip = ip;
+            invoke(name.get(), cache, argCount);
+            frame = &m_frames[m_frameCount - 1];
+            ip = frame->ip;
+            break;
+        }
+        case OpCode::TailCall:
+        {
+            m_heap.collectIfNeeded();
+            const int argCount = readByte();
+            frame->ip = ip;
+            const int frameCount = m_frameCount;
+            callValue(peek(argCount), argCount);
+            replaceCaller(frameCount);
+            frame = &m_frames[m_frameCount - 1];
+            ip = frame->ip;
+            break;
+        }
+        case OpCode::TailInvoke:
+        {
+            m_heap.collectIfNeeded();
+            const auto& name = chunk().names[readShort()];
+            auto& cache = chunk().caches[readShort()];
+            const int argCount = readByte();
+            frame->ip = ip;
+            const int frameCount = m_frameCount;
+            invoke(name.get(), cache, argCount);
+            replaceCaller(frameCount);
+            frame = &m_frames[m_frameCount - 1];
+            ip = frame->ip;
+            break;
+        }
+        case OpCode::Closure:
+        {
+            auto* closure = m_heap.make<VmClosure>(chunk().functions[readShort()]);
+            for (auto& upvalue : closure->upvalues)
+            {
+                const bool isLocal = readByte();
+                const int index = readByte();
+                upvalue = isLocal ? captureUpvalue(frame->slots + index) : frame->closure->upvalues[index];
+            }
+            push(Value(closure));
+            break;
+        }
+        case OpCode::CloseUpvalue:
+            closeUpvalues(m_stackTop - 1);
+            pop();
+            break;
+        case OpCode::Return:
+        {
+            Value result = pop();
+            closeUpvalues(frame->slots);
+            m_frameCount--;
+            if (m_frameCount == 0)
+            {
+                reset();
+                return result;
+            }
+
+            m_stackTop = frame->slots;
+            push(result);
+            frame = &m_frames[m_frameCount - 1];
+            ip = frame->ip;
+            break;
+        }
+        case OpCode::Class:
+            push(Value(m_heap.make<LoxClass>(chunk().names[readShort()]->chars)));
+            break;
+        case OpCode::Method:
+        {
+            auto& clazz = static_cast<LoxClass&>(*peek(1).getCallable());
+            clazz.methods[chunk().names[readShort()].get()] = peek(0).getCallable();
+            pop();
+            break;
+        }
+        }
+    }
+}
+
+void VM::callValue(const Value& callee, int argCount)
+{
+    auto error = [&](const std::string& message)
+    {
+        const auto& frame = m_frames[m_frameCount - 1];
+        const auto& chunk = frame.closure->function->chunk;
+        throw RuntimeError(chunk.tokenAt(frame.ip - 1 - chunk.code.data()), message);
+    };
+
+    if (!callee.isCallable())
+        error("Value is not callable");
+
+    auto& callable = *callee.getCallable();
+    if (callable.kind == ICallable::Kind::Closure)
+        return callClosure(static_cast<VmClosure&>(callable), argCount);
+
+    const int arity = callable.arity();
+    if (arity != argCount)
+        error(fmt::format("Expected {} arguments but got {}.", arity, argCount));
+
+    switch (callable.kind)
+    {
+    case ICallable::Kind::BoundMethod:
+    {
+        auto& bound = static_cast<VmBoundMethod&>(callable);
+        auto& method = *bound.method;
+        Value receiver = bound.receiver;
+        m_stackTop[-argCount - 1] = std::move(receiver);
+        return callClosure(method, argCount);
+    }
+    case ICallable::Kind::Class:
+    {
+        if (m_stats.counting)
+            m_stats.instances++;
+        peek(0) = Value(m_heap.make<LoxInstance>(static_cast<LoxClass*>(&callable)));
+        return;
+    }
+    case ICallable::Kind::Native:
+    {
+        Value result;
+        try
+        {
+            result = static_cast<NativeFunction&>(callable).call({m_stackTop - argCount, m_stackTop});
+        }
+        catch (const NativeError& e)
+        {
+            // Called by the host there is no call site to report it at, the host does.
+            if (m_frameCount == 0)
+                throw;
+            error(e.message);
+        }
+        while (argCount-- >= 0)
+            pop();
+        push(result);
+        return;
+    }
+    default:
+        assert(0 && "unreachable");
+    }
+}
+
+void VM::callClosure(VmClosure& closure, int argCount)
+{
+    auto error = [&](const std::string& message)
+    {
+        const auto& frame = m_frames[m_frameCount - 1];
+        const auto& chunk = frame.closure->function->chunk;
+        throw RuntimeError(chunk.tokenAt(frame.ip - 1 - chunk.code.data()), message);
+    };
+
+    if (argCount != closure.function->arity)
+        error(fmt::format("Expected {} arguments but got {}.", closure.function->arity, argCount));
+    const bool full = m_frameCount == static_cast<int>(m_frames.size()) ||
+                      m_stack.data() + m_stack.size() - m_stackTop < FrameSlots;
+    if (full && !growStack())
+        error("Stack overflow.");
+
+    auto& frame = m_frames[m_frameCount++];
+    frame.closure = &closure;
+    frame.ip = closure.function->chunk.code.data();
+    frame.slots = m_stackTop - argCount - 1;
+    if (m_stats.counting)
+        m_stats.enterCall(m_frameCount - 1);
+}
+
+bool VM::growStack()
+{
+    const bool moreFrames = m_frameCount == static_cast<int>(m_frames.size());
+    const bool moreSlots = m_stack.data() + m_stack.size() - m_stackTop < FrameSlots;
+    const size_t frameCount = moreFrames ? m_frames.size() * 2 : m_frames.size();
+    const size_t slotCount = moreSlots ? m_stack.size() * 2 : m_stack.size();
+    if (frameCount * sizeof(CallFrame) + slotCount * sizeof(Value) > m_stackSize)
+        return false;
+
+    m_frames.resize(frameCount);
+    if (!moreSlots)
+        return true;
+
+    const Value* old = m_stack.data();
+    m_stack.resize(slotCount);
+    auto move = [&](Value* slot) { return m_stack.data() + (slot - old); };
+    m_stackTop = move(m_stackTop);
+    for (int i = 0; i < m_frameCount; i++)
+        m_frames[i].slots = move(m_frames[i].slots);
+    for (auto* upvalue : m_openUpvalues)
+        upvalue->location = move(upvalue->location);
+    return true;
+}
+
+void VM::invoke(const LoxString* name, PropertyCache& cache, int argCount)
+{
+    // Property lookup errors point at the name, which is 6 bytes behind the operands.
+    auto error = [&](const std::string& message)
+    {
+        const auto& frame = m_frames[m_frameCount - 1];
+        const auto& chunk = frame.closure->function->chunk;
+        throw RuntimeError(chunk.tokenAt(frame.ip - 6 - chunk.code.data()), message);
+    };
+
+    Value& receiver = peek(argCount);
+    if (!receiver.isInstance())
+        error("Only instances have properties");
+
+    const auto& instance = *receiver.getInstance();
+    const auto property = instance.getProperty(name, cache);
+    if (property.isField())
+    {
+        receiver = instance.fields[property.slot];
+        return callValue(receiver, argCount);
+    }
+
+    if (!property.isMethod())
+        error(fmt::format("Undefined property '{}'", name->chars));
+
+    callClosure(static_cast<VmClosure&>(*property.method), argCount);
+}
+
+void VM::replaceCaller(int callerCount)
+{
+    if (m_frameCount == callerCount)
+        return;
+
+    // The caller has nothing left to do but return, so its locals go and the callee's slots
+    // move down over them.
+    auto& caller = m_frames[callerCount - 1];
+    const auto& callee = m_frames[callerCount];
+    closeUpvalues(caller.slots);
+    m_stackTop = std::copy(callee.slots, m_stackTop, caller.slots);
+    caller.closure = callee.closure;
+    caller.ip = callee.ip;
+    m_frameCount = callerCount;
+}
+
+VmUpvalue* VM::captureUpvalue(Value* local)
+{
+    auto it = m_openUpvalues.end();
+    while (it != m_openUpvalues.begin() && (*std::prev(it))->location > local)
+        --it;
+
+    if (it != m_openUpvalues.begin() && (*std::prev(it))->location == local)
+        return *std::prev(it);
+
+    return *m_openUpvalues.insert(it, m_heap.make<VmUpvalue>(local));
+}
+
+void VM::closeUpvalues(Value* last)
+{
+    while (!m_openUpvalues.empty() && m_openUpvalues.back()->location >= last)
+    {
+        auto& upvalue = *m_openUpvalues.back();
+        upvalue.closed = *upvalue.location;
+        upvalue.location = &upvalue.closed;
+        m_openUpvalues.pop_back();
+    }
+}
+
+void VM::reset()
+{
+    m_stackTop = m_stack.data();
+    m_frameCount = 0;
+    m_openUpvalues.clear();
+}
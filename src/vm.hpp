@@ -0,0 +1,139 @@
+#pragma once
+
+#include "chunk.hpp"
+#include "heap.hpp"
+#include "stack.hpp"
+#include "stats.hpp"
+#include "value.hpp"
+
+#include <optional>
+#include <unordered_map>
+
+class VmUpvalue : public Obj
+{
+public:
+    VmUpvalue(Value* location) : Obj(Type::Upvalue), location(location) {}
+
+    void trace(Heap& heap) const override { heap.mark(closed); }
+
+    // Points into the VM stack while open, at `closed` once the variable leaves the stack.
+    Value* location;
+    Value closed;
+};
+
+class VmClosure : public ICallable
+{
+public:
+    VmClosure(std::shared_ptr<VmFunction> function)
+        : ICallable(Kind::Closure), function(std::move(function)), upvalues(this->function->upvalueCount)
+    {
+    }
+
+    std::string toString() const override;
+    int arity() const override { return function->arity; }
+    void trace(Heap& heap) const override;
+
+    std::shared_ptr<VmFunction> function;
+    std::vector<VmUpvalue*> upvalues;
+};
+
+class VmBoundMethod : public ICallable
+{
+public:
+    VmBoundMethod(const Value& receiver, VmClosure* method)
+        : ICallable(Kind::BoundMethod), receiver(receiver), method(method)
+    {
+    }
+
+    std::string toString() const override { return method->toString(); }
+    int arity() const override { return method->arity(); }
+    void trace(Heap& heap) const override;
+
+    Value receiver;
+    VmClosure* method;
+};
+
+class VM : public GcRoots
+{
+public:
+    VM(Heap& heap, Stats& stats);
+    ~VM();
+
+    void markRoots(Heap& heap) const override;
+
+    // Where print statements write to, stdout by default.
+    void setOutput(std::FILE* output) { m_output = output; }
+    // Bytes the call frames and the value stack may grow to, which limits how deep calls nest.
+    void setStackSize(size_t bytes) { m_stackSize = bytes; }
+
+    void interpret(std::shared_ptr<VmFunction> script);
+    // Calls a closure, class or native from outside any Lox code, checked for arity by the caller.
+    Value call(const Value& callee, std::span<const Value> arguments);
+    // The value of a global variable, empty if it isn't defined.
+    std::optional<Value> global(std::string_view name) const;
+    void defineGlobal(std::string_view name, const Value& value);
+
+    // Globals are resolved to slots at compile time; the slot stays undefined until the
+    // script defines it, so globals keep their late-bound semantics.
+    int globalSlot(std::string_view name);
+    // Indexed by slot.
+    const std::vector<std::string>& globalNames() const { return m_globalNames; }
+
+private:
+    // Kept free above the top of the stack when a call starts, as no function uses more.
+    static constexpr int FrameSlots = 256;
+    // Both grow from here, as far as the stack size allows.
+    static constexpr int InitialFrames = 64;
+    static constexpr int InitialSlots = InitialFrames * FrameSlots;
+
+    struct CallFrame
+    {
+        VmClosure* closure;
+        const uint8_t* ip;
+        Value* slots;
+    };
+
+    struct Global
+    {
+        Value value;
+        bool defined = false;
+    };
+
+    // Runs until the outermost frame returns, and returns its result.
+    Value run();
+
+    void push(const Value& value) { *m_stackTop++ = value; }
+    Value pop() { return std::move(*--m_stackTop); }
+    Value& peek(int distance) { return m_stackTop[-1 - distance]; }
+
+    // Runtime errors raised by these are reported at the calling instruction of the top frame.
+    void callValue(const Value& callee, int argCount);
+    void callClosure(VmClosure& closure, int argCount);
+    // Makes room for another frame, false if that would take more than the stack size.
+    bool growStack();
+    void invoke(const LoxString* name, PropertyCache& cache, int argCount);
+    // Makes the frame a tail call just pushed take the place of the caller's, when it pushed one.
+    void replaceCaller(int callerCount);
+
+    VmUpvalue* captureUpvalue(Value* local);
+    void closeUpvalues(Value* last);
+
+    void reset();
+
+    Heap& m_heap;
+    Stats& m_stats;
+    std::FILE* m_output = stdout;
+    size_t m_stackSize = DefaultStackSize;
+    // Frames and upvalues point into it, they are moved along when it grows.
+    std::vector<Value> m_stack;
+    Value* m_stackTop;
+    std::vector<CallFrame> m_frames;
+    int m_frameCount = 0;
+
+    // Sorted by stack location, innermost last.
+    std::vector<VmUpvalue*> m_openUpvalues;
+
+    std::vector<Global> m_globals;
+    std::vector<std::string> m_globalNames;
+    std::unordered_map<std::string, int> m_globalSlots;
+};
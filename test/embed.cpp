@@ -0,0 +1,149 @@
+// A host embedding Lox: compiles a script once, then calls its functions from C++.
+
+#include "lox.hpp"
+
+#include <cmath>
+#include <charconv>
+
+static const char* Script = R"(
+fun add(a, b) {
+    return a + b;
+}
+
+fun fib(n) {
+    if (n < 2) return n;
+    return fib(n - 2) + fib(n - 1);
+}
+
+fun greet(name) {
+    return "Hello, " + name + "!";
+}
+
+fun counter() {
+    var count = 0;
+    fun increment() {
+        count = count + 1;
+        return count;
+    }
+    return increment;
+}
+
+fun fail(value) {
+    return value + nil;
+}
+
+class Point {}
+
+var answer = 42;
+)";
+
+// Host functions bound with defineNative.
+
+static double hypotenuse(double a, double b)
+{
+    return std::sqrt(a * a + b * b);
+}
+
+static std::string repeat(std::string_view text, int count)
+{
+    std::string repeated;
+    for (int i = 0; i < count; i++)
+        repeated += text;
+    return repeated;
+}
+
+static bool isEmpty(const std::string& text)
+{
+    return text.empty();
+}
+
+static void shout(std::string_view text)
+{
+    fmt::println("{}!", text);
+}
+
+static double parse(std::string_view text)
+{
+    double number = 0;
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), number);
+    if (ec != std::errc() || end != text.data() + text.size())
+        throw NativeError{fmt::format("'{}' is not a number.", text)};
+    return number;
+}
+
+static void print(const CallResult& result)
+{
+    if (result)
+        fmt::println("{}", result.value);
+    else
+        fmt::println("{}", *result.error);
+}
+
+int main(int argc, char** argv)
+{
+    const bool vm = argc > 1 && std::string_view(argv[1]) == "--engine=vm";
+    Lox lox(vm ? Engine::VM : Engine::Interpreter);
+
+    if (const auto errors = lox.run(Script); !errors.empty())
+    {
+        for (const auto& error : errors)
+            fmt::println("{}", error);
+        return 1;
+    }
+
+    // Looked up once, called many times.
+    const auto fib = lox.global("fib");
+    for (int n = 0; n <= 10; n++)
+    {
+        const Value argument(static_cast<double>(n));
+        print(lox.call(*fib, {&argument, 1}));
+    }
+
+    print(lox.call("add", std::array{Value(1.0), Value(2.0)}));
+    print(lox.call("greet", std::array{lox.string("host")}));
+    fmt::println("{}", *lox.global("answer"));
+
+    // A closure returned to the host keeps its state between calls.
+    const auto increment = lox.call("counter", {});
+    print(lox.call(increment.value, {}));
+    print(lox.call(increment.value, {}));
+
+    print(lox.call("Point", {}));
+    fmt::println("{}", lox.call("clock", {}).value.isNumber());
+
+    // Errors come back as values and leave the interpreter usable.
+    print(lox.call("fail", std::array{Value(1.0)}));
+    print(lox.call("add", std::array{Value(1.0)}));
+    print(lox.call("missing", {}));
+    print(lox.call("answer", {}));
+    for (const auto& error : lox.run("var = 1;"))
+        fmt::println("{}", error);
+    fmt::println("{}", lox.global("nothing").has_value());
+
+    // Natives are called from scripts and from the host alike.
+    lox.defineNative<&hypotenuse>("hypot");
+    lox.defineNative<&repeat>("repeat");
+    lox.defineNative<&isEmpty>("isEmpty");
+    lox.defineNative<&shout>("shout");
+    lox.defineNative<&parse>("parse");
+    lox.run("print hypot(3, 4);\nprint repeat(\"ab\", 3);\nprint isEmpty(\"\");\nprint shout(\"hey\");\nprint parse(\"1.5\") + 1;");
+    for (const auto& source :
+         {"hypot(\"3\", 4);",
+          "repeat(\"ab\", nil);",
+          "repeat(\"ab\", 1.5);",
+          "repeat(\"ab\", 10000000000);",
+          "repeat(\"ab\", 0/0);",
+          "parse(\"x\");",
+          "hypot(1);"})
+    {
+        for (const auto& error : lox.run(source))
+            fmt::println("{}", error);
+    }
+    print(lox.call("hypot", std::array{Value(6.0), Value(8.0)}));
+    print(lox.call("hypot", std::array{Value(6.0), Value(true)}));
+
+    // Later scripts see the globals of earlier ones.
+    lox.run("var sum = add(answer, 1);");
+    fmt::println("{}", *lox.global("sum"));
+    print(lox.call("add", std::array{Value(3.0), Value(4.0)}));
+}
@@ -0,0 +1,87 @@
+// Runs scripts on many isolates at once, one thread each, and checks that every run printed what
+// the script's .txt file says it should.
+//
+// Usage: lox-parallel [--engine=vm] [--threads=n] script...
+
+#include "lox.hpp"
+
+#include <atomic>
+#include <charconv>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+static std::string readFile(const std::string& path)
+{
+    std::ifstream file(path);
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+static std::string readAll(std::FILE* file)
+{
+    std::string text;
+    std::rewind(file);
+    char buffer[4096];
+    while (const size_t size = std::fread(buffer, 1, sizeof(buffer), file))
+        text.append(buffer, size);
+    return text;
+}
+
+int main(int argc, char** argv)
+{
+    Engine engine = Engine::Interpreter;
+    int threads = 8;
+    std::vector<std::string> scripts;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+        if (arg == "--engine=vm")
+            engine = Engine::VM;
+        else if (arg.starts_with("--threads="))
+            std::from_chars(arg.data() + arg.find('=') + 1, arg.data() + arg.size(), threads);
+        else
+            scripts.emplace_back(arg);
+    }
+
+    std::vector<std::string> expected;
+    for (const auto& script : scripts)
+        expected.push_back(readFile(script.substr(0, script.rfind('.')) + ".txt"));
+
+    std::atomic<int> failures = 0;
+    {
+        std::vector<std::jthread> workers;
+        for (int thread = 0; thread < threads; thread++)
+        {
+            workers.emplace_back(
+                [&, thread]()
+                {
+                    // Every thread runs every script, starting at a different one, each on a new isolate.
+                    for (size_t i = 0; i < scripts.size(); i++)
+                    {
+                        const size_t index = (i + thread) % scripts.size();
+                        Lox lox(engine);
+                        // Collects often, so the heaps are busy collecting at the same time.
+                        lox.heap().setThreshold(16 * 1024);
+
+                        std::FILE* output = std::tmpfile();
+                        lox.setOutput(output);
+                        auto source = Source::load(scripts[index].c_str());
+                        const auto errors = source ? lox.run(std::move(*source)) : std::vector<ScriptError>{};
+                        const auto printed = readAll(output);
+                        std::fclose(output);
+
+                        if (!source || !errors.empty() || printed != expected[index])
+                        {
+                            fmt::println(stderr, "{} printed something else on thread {}", scripts[index], thread);
+                            failures++;
+                        }
+                    }
+                });
+        }
+    }
+
+    fmt::println("{} runs on {} threads, {} failed", scripts.size() * threads, threads, failures.load());
+    return failures > 0 ? 1 : 0;
+}
@@ -1,11 +1,14 @@
+import os
+import re
+import tempfile
 import unittest
 import subprocess
 
 BUILD_FOLDER = 'build/debug/'
 TEST_FOLDER = 'test/'
 
-def run_script(script):
-    command = [BUILD_FOLDER + 'lox', TEST_FOLDER + script]
+def run_script(script, args=[]):
+    command = [BUILD_FOLDER + 'lox', *args, TEST_FOLDER + script]
     return subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
 
 def read_file(file):
@@ -13,72 +16,76 @@ def read_file(file):
         return file.read()
 
 class Basic(unittest.TestCase):
+    args = []
+
+    def run_script(self, script, args=[]):
+        return run_script(script, self.args + args)
 
     def test_print(self):
-        result = run_script('print.lox')
+        result = self.run_script('print.lox')
         
         self.assertEqual(result.returncode, 0)
         self.assertEqual(result.stdout, read_file('print.txt'))
         self.assertEqual(result.stderr, '')
 
     def test_var(self):
-        result = run_script('var.lox')
+        result = self.run_script('var.lox')
 
         self.assertEqual(result.returncode, 0)
         self.assertEqual(result.stdout, read_file('var.txt'))
         self.assertEqual(result.stderr, '')
 
     def test_assignment(self):
-        result = run_script('assignment.lox')
+        result = self.run_script('assignment.lox')
 
         self.assertEqual(result.returncode, 0)
         self.assertEqual(result.stdout, read_file('assignment.txt'))
         self.assertEqual(result.stderr, '')
 
     def test_scope(self):
-        result = run_script('scope.lox')
+        result = self.run_script('scope.lox')
 
         self.assertEqual(result.returncode, 0)
         self.assertEqual(result.stdout, read_file('scope.txt'))
         self.assertEqual(result.stderr, '')
     
     def test_if(self):
-        result = run_script('if.lox')
+        result = self.run_script('if.lox')
 
         self.assertEqual(result.returncode, 0)
         self.assertEqual(result.stdout, read_file('if.txt'))
         self.assertEqual(result.stderr, '')
     
     def test_logical(self):
-        result = run_script('logical.lox')
+        result = self.run_script('logical.lox')
 
         self.assertEqual(result.returncode, 0)
         self.assertEqual(result.stdout, read_file('logical.txt'))
         self.assertEqual(result.stderr, '')
     
     def test_while(self):
-        result = run_script('while.lox')
+        result = self.run_script('while.lox')
 
         self.assertEqual(result.returncode, 0)
         self.assertEqual(result.stdout, read_file('while.txt'))
         self.assertEqual(result.stderr, '')
     
     def test_for(self):
-        result = run_script('for.lox')
+        result = self.run_script('for.lox')
 
         self.assertEqual(result.returncode, 0)
         self.assertEqual(result.stdout, read_file('for.txt'))
         self.assertEqual(result.stderr, '')
     
     def test_operator(self):
-        result = run_script('operator.lox')
+        result = self.run_script('operator.lox')
 
         self.assertEqual(result.returncode, 0)
         self.assertEqual(result.stdout, read_file('operator.txt'))
         self.assertEqual(result.stderr, '')
 
     def test_clock(self):
-        result = run_script('clock.lox')
+        result = self.run_script('clock.lox')
 
         self.assertEqual(result.returncode, 0)
         self.assertEqual(result.stderr, '')
@@ -87,46 +94,255 @@ class Basic(unittest.TestCase):
         self.assertTrue(0 <= clock <= 1)
     
     def test_function(self):
-        result = run_script('function.lox')
+        result = self.run_script('function.lox')
 
         self.assertEqual(result.returncode, 0)
         self.assertEqual(result.stdout, read_file('function.txt'))
         self.assertEqual(result.stderr, '')
     
     def test_fib(self):
-        result = run_script('fib.lox')
+        result = self.run_script('fib.lox')
 
         self.assertEqual(result.returncode, 0)
         self.assertEqual(result.stdout, read_file('fib.txt'))
         self.assertEqual(result.stderr, '')
     
     def test_closure(self):
-        result = run_script('closure.lox')
+        result = self.run_script('closure.lox')
 
         self.assertEqual(result.returncode, 0)
         self.assertEqual(result.stdout, read_file('closure.txt'))
         self.assertEqual(result.stderr, '')
     
+    def test_upvalue(self):
+        result = self.run_script('upvalue.lox')
+
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, read_file('upvalue.txt'))
+        self.assertEqual(result.stderr, '')
+
+    def test_frame(self):
+        result = self.run_script('frame.lox', ['--gc-threshold=1024'])
+
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, read_file('frame.txt'))
+        self.assertEqual(result.stderr, '')
+
+    def test_tail(self):
+        result = self.run_script('tail.lox')
+
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, read_file('tail.txt'))
+        self.assertEqual(result.stderr, '')
+
+    def test_recursion(self):
+        result = self.run_script('recursion.lox')
+
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, read_file('recursion.txt'))
+        self.assertEqual(result.stderr, '')
+
+    def test_overflow(self):
+        result = self.run_script('overflow.lox', ['--stack-size=1048576'])
+
+        self.assertEqual(result.returncode, 1)
+        self.assertEqual(result.stdout, '')
+        self.assertEqual(result.stderr, "[line 2] Error at ')': Stack overflow.\n")
+
+    def test_array(self):
+        result = self.run_script('array.lox', ['--gc-threshold=1024'])
+
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, read_file('array.txt'))
+        self.assertEqual(result.stderr, '')
+
+    def test_array_gc(self):
+        # The arrays are created empty, their buffers grow by push.
+        result = self.run_script('array_gc.lox', ['--gc-stats'])
+
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, read_file('array_gc.txt'))
+        collections = re.search(r'(\d+) collections', result.stderr)
+        self.assertIsNotNone(collections)
+        self.assertGreater(int(collections.group(1)), 0)
+
+    def test_array_errors(self):
+        code = 'var a = [1, 2];\nprint a[2];\nprint a[0.5];\nprint a["x"];\nprint 1[0];\nsum(["x"]);\ndot(a, [1]);\n'
+        command = [BUILD_FOLDER + 'lox', *self.args]
+        result = subprocess.run(command, input=code, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(re.findall(r'\[line.*', result.stderr), [
+            "[line 1] Error at ']': Array index out of range.",
+            "[line 1] Error at ']': Array index out of range.",
+            "[line 1] Error at ']': Array index must be a number.",
+            "[line 1] Error at ']': Only arrays can be indexed.",
+            "[line 1] Error at ')': Array must only hold numbers.",
+            "[line 1] Error at ')': Arrays must have the same length.",
+        ])
+
     def test_resolve(self):
-        result = run_script('resolve.lox')
+        result = self.run_script('resolve.lox')
 
         self.assertEqual(result.returncode, 0)
         self.assertEqual(result.stdout, read_file('resolve.txt'))
         self.assertEqual(result.stderr, '')
     
     def test_class(self):
-        result = run_script('class.lox')
+        result = self.run_script('class.lox')
 
         self.assertEqual(result.returncode, 0)
         self.assertEqual(result.stdout, read_file('class.txt'))
         self.assertEqual(result.stderr, '')
     
     def test_cake(self):
-        result = run_script('cake.lox')
+        result = self.run_script('cake.lox')
 
         self.assertEqual(result.returncode, 0)
         self.assertEqual(result.stdout, read_file('cake.txt'))
         self.assertEqual(result.stderr, '')
 
+    def test_method(self):
+        result = self.run_script('method.lox')
+
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, read_file('method.txt'))
+        self.assertEqual(result.stderr, '')
+
+    def test_property(self):
+        result = self.run_script('property.lox')
+
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, read_file('property.txt'))
+        self.assertEqual(result.stderr, '')
+
+    def test_prompt(self):
+        # Functions declared on one line are called from later ones.
+        code = 'fun add(a) { return a + 1; }\nclass A { get() { return add(2); } }\nprint A().get();\n'
+        command = [BUILD_FOLDER + 'lox', *self.args]
+        result = subprocess.run(command, input=code, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, '3\n')
+
+    def test_pipe(self):
+        # Scripts that can't be mapped, like a pipe, are read instead.
+        command = [BUILD_FOLDER + 'lox', *self.args, '/dev/stdin']
+        result = subprocess.run(command, input=read_file('fib.lox'), stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, read_file('fib.txt'))
+        self.assertEqual(result.stderr, '')
+
+    def test_gc(self):
+        result = self.run_script('gc.lox', ['--gc-stats', '--gc-threshold=65536'])
+
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, read_file('gc.txt'))
+        freed = re.search(r'freed (\d+) objects', result.stderr)
+        self.assertIsNotNone(freed)
+        self.assertGreater(int(freed.group(1)), 0)
+
+    def test_stats(self):
+        result = self.run_script('fib.lox', ['--stats'])
+
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, read_file('fib.txt'))
+        self.assertIn('[stats] 57 tokens, 35 AST nodes', result.stderr)
+        self.assertIn('[stats] 35400 calls', result.stderr)
+        self.assertIn('[stats] peak call depth 19', result.stderr)
+
+    def test_profile(self):
+        with tempfile.TemporaryDirectory() as folder:
+            folded = os.path.join(folder, 'fib.folded')
+            result = self.run_script('fib.lox', ['--profile=' + folded, '--profile-interval=100'])
+
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout, read_file('fib.txt'))
+            self.assertRegex(result.stderr, r'\[profile\] \d+ samples')
+            self.assertRegex(result.stderr, r'line [24] in fib:1')
+            with open(folded) as file:
+                stacks = file.read().splitlines()
+            self.assertGreater(len(stacks), 0)
+            for stack in stacks:
+                self.assertRegex(stack, r'^<script>(;fib:1)* \d+$')
+
+    def test_cache(self):
+        result = self.run_script('fib.lox', ['--cache'])
+
+        self.assertEqual(result.returncode, 1)
+        self.assertEqual(result.stdout, '')
+
+    def test_embed(self):
+        # A C++ host calling the functions of a script it compiled once, see embed.cpp.
+        command = [BUILD_FOLDER + 'lox-embed', *self.args]
+        result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, read_file('embed.txt'))
+        self.assertEqual(result.stderr, '')
+
+    def test_parallel(self):
+        # Every script with an expected output runs on 8 isolates on their own threads at once.
+        scripts = [TEST_FOLDER + name for name in sorted(os.listdir(TEST_FOLDER))
+                   if name.endswith('.lox') and os.path.exists(TEST_FOLDER + name[:-4] + '.txt')]
+        command = [BUILD_FOLDER + 'lox-parallel', *self.args, '--threads=8', *scripts]
+        result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, f'{len(scripts) * 8} runs on 8 threads, 0 failed\n')
+        self.assertEqual(result.stderr, '')
+
+class VM(Basic):
+    args = ['--engine=vm']
+
+    def test_cache(self):
+        with tempfile.TemporaryDirectory() as folder:
+            compiled = self.run_script('fib.lox', ['--cache=' + folder, '--stats'])
+            cached = self.run_script('fib.lox', ['--cache=' + folder, '--stats'])
+
+            self.assertEqual(len(os.listdir(folder)), 1)
+            for result in (compiled, cached):
+                self.assertEqual(result.returncode, 0)
+                self.assertEqual(result.stdout, read_file('fib.txt'))
+            self.assertIn('[stats] 57 tokens', compiled.stderr)
+            # The cached run skips the front end.
+            self.assertIn('[stats] 0 tokens, 0 AST nodes', cached.stderr)
+            self.assertIn('[stats] 35400 calls', cached.stderr)
+
+    def test_cache_damaged(self):
+        with tempfile.TemporaryDirectory() as folder:
+            self.run_script('fib.lox', ['--cache=' + folder])
+            path = os.path.join(folder, os.listdir(folder)[0])
+            with open(path, 'rb') as file:
+                entry = bytearray(file.read())
+
+            # Point the script's first instruction, the closure of fib, at a function it doesn't have.
+            def skip_string(offset):
+                return offset + 4 + int.from_bytes(entry[offset:offset + 4], 'little')
+            offset = 32
+            globals = int.from_bytes(entry[offset:offset + 4], 'little')
+            offset += 4
+            for _ in range(globals):
+                offset = skip_string(offset)
+            offset = skip_string(offset) + 12
+            code = offset + 4
+            self.assertEqual(entry[code], 37)
+            entry[code + 1:code + 3] = b'\xff\xff'
+            with open(path, 'wb') as file:
+                file.write(entry)
+
+            # The entry is rejected and compiled over.
+            result = self.run_script('fib.lox', ['--cache=' + folder, '--stats'])
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout, read_file('fib.txt'))
+            self.assertIn('[stats] 57 tokens', result.stderr)
+
+    def test_profile(self):
+        result = self.run_script('fib.lox', ['--profile'])
+
+        self.assertEqual(result.returncode, 1)
+        self.assertEqual(result.stdout, '')
+
 if __name__ == '__main__':
     unittest.main()